@@ -0,0 +1,526 @@
+/* Hot-path benchmark: the per-tick cost of umon's own sampling and drawing.
+ *
+ * Build and run with `make bench`. Prints one JSON object per line on
+ * stdout, so runs of two versions can be saved and compared:
+ *
+ *   ./bench/bench_hotpath > before.jsonl
+ *
+ * Every line carries ns_per_op, allocs_per_op and syscalls_per_op; for the
+ * tick cases an op is one tick. Allocations and syscalls are counted by
+ * wrapping the libc entry points umon calls (see HOTPATH_WRAP in the
+ * Makefile), so calls libc makes internally, such as stdio's or
+ * localtime's, are not seen; the vDSO clock_gettime is not a syscall.
+ *
+ * The synthetic cases run the real collectors on generated /proc files
+ * through --replay: each size writes a capture with SYNTH_TICKS ticks of
+ * advancing counters, statvfs answers and link speeds, and loops over it,
+ * in a forked child so that every size starts from clean tables. The
+ * frame goes to /dev/null on a fixed BENCH_ROWS x BENCH_COLS screen with
+ * colours on, the interactive path.
+ * A final live case samples this host's own /proc for LIVE_TICKS ticks.
+ */
+#define UMON_NO_MAIN
+#include "../umon.c"
+
+#include <sys/wait.h>
+
+#define BENCH_MIN_NS 2e8
+#define BENCH_ROWS 60
+#define BENCH_COLS 200
+#define SYNTH_TICKS 32
+#define LIVE_TICKS 200
+
+static unsigned long long allocs = 0;
+static unsigned long long syscalls = 0;
+static int out_fd = STDOUT_FILENO;
+static volatile double sink;
+
+/* Counting wrappers; statvfs runs on the worker threads */
+#define COUNT(c) __atomic_fetch_add(&(c), 1, __ATOMIC_RELAXED)
+
+void *__real_malloc(size_t n);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *p, size_t n);
+char *__real_strdup(const char *s);
+void *__wrap_malloc(size_t n) { COUNT(allocs); return __real_malloc(n); }
+void *__wrap_calloc(size_t n, size_t size) { COUNT(allocs); return __real_calloc(n, size); }
+void *__wrap_realloc(void *p, size_t n) { COUNT(allocs); return __real_realloc(p, n); }
+char *__wrap_strdup(const char *s) { COUNT(allocs); return __real_strdup(s); }
+
+ssize_t __real_read(int fd, void *buf, size_t n);
+ssize_t __real_write(int fd, const void *buf, size_t n);
+ssize_t __real_pread(int fd, void *buf, size_t n, off_t off);
+int __real_open(const char *path, int flags, ...);
+int __real_openat(int dirfd, const char *path, int flags, ...);
+int __real_close(int fd);
+int __real_poll(struct pollfd *fds, nfds_t n, int timeout);
+int __real_epoll_wait(int epfd, struct epoll_event *ev, int max, int timeout);
+ssize_t __real_recv(int fd, void *buf, size_t n, int flags);
+ssize_t __real_send(int fd, const void *buf, size_t n, int flags);
+int __real_access(const char *path, int mode);
+int __real_fstat(int fd, struct stat *st);
+int __real_lstat(const char *path, struct stat *st);
+int __real_ioctl(int fd, unsigned long req, ...);
+off_t __real_lseek(int fd, off_t off, int whence);
+int __real_statvfs(const char *path, struct statvfs *st);
+long __real_syscall(long nr, ...);
+int __real_getrusage(int who, struct rusage *ru);
+int __real_timerfd_settime(int fd, int flags, const struct itimerspec *v, struct itimerspec *old);
+int __real_clock_nanosleep(clockid_t clk, int flags, const struct timespec *t, struct timespec *rem);
+
+ssize_t __wrap_read(int fd, void *buf, size_t n) { COUNT(syscalls); return __real_read(fd, buf, n); }
+ssize_t __wrap_write(int fd, const void *buf, size_t n) { COUNT(syscalls); return __real_write(fd, buf, n); }
+ssize_t __wrap_pread(int fd, void *buf, size_t n, off_t off) { COUNT(syscalls); return __real_pread(fd, buf, n, off); }
+int __wrap_close(int fd) { COUNT(syscalls); return __real_close(fd); }
+int __wrap_poll(struct pollfd *fds, nfds_t n, int timeout) { COUNT(syscalls); return __real_poll(fds, n, timeout); }
+int __wrap_epoll_wait(int epfd, struct epoll_event *ev, int max, int timeout) { COUNT(syscalls); return __real_epoll_wait(epfd, ev, max, timeout); }
+ssize_t __wrap_recv(int fd, void *buf, size_t n, int flags) { COUNT(syscalls); return __real_recv(fd, buf, n, flags); }
+ssize_t __wrap_send(int fd, const void *buf, size_t n, int flags) { COUNT(syscalls); return __real_send(fd, buf, n, flags); }
+int __wrap_access(const char *path, int mode) { COUNT(syscalls); return __real_access(path, mode); }
+int __wrap_fstat(int fd, struct stat *st) { COUNT(syscalls); return __real_fstat(fd, st); }
+int __wrap_lstat(const char *path, struct stat *st) { COUNT(syscalls); return __real_lstat(path, st); }
+off_t __wrap_lseek(int fd, off_t off, int whence) { COUNT(syscalls); return __real_lseek(fd, off, whence); }
+int __wrap_statvfs(const char *path, struct statvfs *st) { COUNT(syscalls); return __real_statvfs(path, st); }
+int __wrap_getrusage(int who, struct rusage *ru) { COUNT(syscalls); return __real_getrusage(who, ru); }
+int __wrap_timerfd_settime(int fd, int flags, const struct itimerspec *v, struct itimerspec *old) {
+    COUNT(syscalls);
+    return __real_timerfd_settime(fd, flags, v, old);
+}
+int __wrap_clock_nanosleep(clockid_t clk, int flags, const struct timespec *t, struct timespec *rem) {
+    COUNT(syscalls);
+    return __real_clock_nanosleep(clk, flags, t, rem);
+}
+
+int __wrap_open(const char *path, int flags, ...) {
+    va_list ap;
+    va_start(ap, flags);
+    mode_t mode = (flags & O_CREAT) ? va_arg(ap, mode_t) : 0;
+    va_end(ap);
+    COUNT(syscalls);
+    return __real_open(path, flags, mode);
+}
+
+int __wrap_openat(int dirfd, const char *path, int flags, ...) {
+    va_list ap;
+    va_start(ap, flags);
+    mode_t mode = (flags & O_CREAT) ? va_arg(ap, mode_t) : 0;
+    va_end(ap);
+    COUNT(syscalls);
+    return __real_openat(dirfd, path, flags, mode);
+}
+
+int __wrap_ioctl(int fd, unsigned long req, ...) {
+    va_list ap;
+    va_start(ap, req);
+    void *arg = va_arg(ap, void *);
+    va_end(ap);
+    COUNT(syscalls);
+    return __real_ioctl(fd, req, arg);
+}
+
+long __wrap_syscall(long nr, ...) {
+    va_list ap;
+    va_start(ap, nr);
+    long a = va_arg(ap, long), b = va_arg(ap, long), c = va_arg(ap, long);
+    long d = va_arg(ap, long), e = va_arg(ap, long), f = va_arg(ap, long);
+    va_end(ap);
+    COUNT(syscalls);
+    return __real_syscall(nr, a, b, c, d, e, f);
+}
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* Accumulated cost of a run of ops */
+typedef struct {
+    unsigned long long ops;
+    double ns;
+    unsigned long long allocs, syscalls;
+} cost_t;
+
+typedef struct {
+    double t;
+    unsigned long long allocs, syscalls;
+} mark_t;
+
+static mark_t mark(void) {
+    mark_t m = { now_ns(), __atomic_load_n(&allocs, __ATOMIC_RELAXED), __atomic_load_n(&syscalls, __ATOMIC_RELAXED) };
+    return m;
+}
+
+static void charge(cost_t *c, const mark_t *from, unsigned long long ops) {
+    mark_t to = mark();
+    c->ops += ops;
+    c->ns += to.t - from->t;
+    c->allocs += to.allocs - from->allocs;
+    c->syscalls += to.syscalls - from->syscalls;
+}
+
+/* Runs fn in doubling batches until BENCH_MIN_NS has passed */
+static cost_t measure(void (*fn)(void *arg, long n), void *arg) {
+    cost_t c = { 0, 0, 0, 0 };
+    fn(arg, 1);
+    for (long n = 16; c.ns < BENCH_MIN_NS; n *= 2) {
+        mark_t m = mark();
+        fn(arg, n);
+        charge(&c, &m, n);
+    }
+    return c;
+}
+
+/* params is empty or a run of ,"key":value pairs */
+static void emit(const char *bench, const char *params, const cost_t *c) {
+    double ops = c->ops ? (double)c->ops : 1;
+    dprintf(out_fd, "{\"bench\":\"%s\"%s,\"ops\":%llu,\"ns_per_op\":%.1f,\"allocs_per_op\":%.3f,\"syscalls_per_op\":%.3f}\n",
+            bench, params, c->ops, c->ns / ops, c->allocs / ops, c->syscalls / ops);
+}
+
+/* Synthetic /proc files for tick k. Counters grow by a fixed step per
+ * tick, so every tick has the same rates. */
+static void gen_stat(strbuf_t *sb, int cores, int k) {
+    unsigned long long u = 0, s = 0, i = 0;
+    for (int c = 0; c < cores; c++) {
+        u += 100000 + (unsigned long long)k * (20 + c % 50);
+        s += 50000 + (unsigned long long)k * 10;
+        i += 900000 + (unsigned long long)k * (70 - c % 50);
+    }
+    sb_printf(sb, "cpu  %llu 0 %llu %llu 0 0 0 0 0 0\n", u, s, i);
+    for (int c = 0; c < cores; c++) {
+        sb_printf(sb, "cpu%d %llu 0 %llu %llu 0 0 0 0 0 0\n", c,
+                  100000 + (unsigned long long)k * (20 + c % 50), 50000 + (unsigned long long)k * 10,
+                  900000 + (unsigned long long)k * (70 - c % 50));
+    }
+    sb_printf(sb, "ctxt %d\nbtime 1700000000\nprocesses %d\nprocs_running 2\nprocs_blocked 0\n", k * 1000, k);
+}
+
+static void gen_meminfo(strbuf_t *sb, int k) {
+    sb_printf(sb, "MemTotal:       16384000 kB\nMemFree:         %d kB\nMemAvailable:    %d kB\n"
+              "Buffers:          204800 kB\nCached:          4096000 kB\n"
+              "SwapTotal:       8192000 kB\nSwapFree:        %d kB\n",
+              4096000 - k * 1000, 8192000 - k * 1000, 8000000 - k * 100);
+}
+
+static void gen_netdev(strbuf_t *sb, int ifaces, int k) {
+    sb_printf(sb, "Inter-|   Receive                                                |  Transmit\n"
+              " face |bytes    packets errs drop fifo frame compressed multicast|bytes    packets errs drop fifo colls carrier compressed\n");
+    for (int n = 0; n < ifaces; n++) {
+        unsigned long long rx = (unsigned long long)k * 125000 * (n % 10 + 1);
+        unsigned long long tx = (unsigned long long)k * 62500 * (n % 10 + 1);
+        sb_printf(sb, "veth%04d: %llu %llu 0 0 0 0 0 0 %llu %llu 0 0 0 0 0 0\n", n, rx, rx / 1000, tx, tx / 1000);
+    }
+}
+
+static void gen_diskstats(strbuf_t *sb, int disks, int k) {
+    for (int d = 0; d < disks; d++) {
+        unsigned long long ios = (unsigned long long)k * (100 + d);
+        sb_printf(sb, " 254 %6d bd%03d %llu 0 %llu %llu %llu 0 %llu %llu 0 %llu %llu 0 0 0 0 0 0\n",
+                  d * 16, d, ios, ios * 8, ios / 2, ios, ios * 16, ios, ios ? (unsigned long long)k * 200 : 0, ios * 2);
+    }
+}
+
+static void gen_mounts(strbuf_t *sb, int mounts) {
+    sb_printf(sb, "proc /proc proc rw,nosuid,nodev,noexec,relatime 0 0\n"
+              "sysfs /sys sysfs rw,nosuid,nodev,noexec,relatime 0 0\n"
+              "overlay / overlay rw,relatime,lowerdir=/l,upperdir=/u,workdir=/w 0 0\n");
+    for (int m = 0; m < mounts; m++) sb_printf(sb, "/dev/bd%03d /mnt/data%03d ext4 rw,relatime 0 0\n", m, m);
+}
+
+/* Captures carry each mount's statvfs verdict and, since netlink is off
+ * while recording, every interface's link speed on every tick. Without
+ * them each lookup would scan the whole tick and miss. */
+static void gen_statvfs(int mounts, int k) {
+    char key[64], buf[96];
+    for (int m = 0; m < mounts; m++) {
+        unsigned long long total = 1ULL << 40;
+        int n = snprintf(buf, sizeof(buf), "1 0 %llu %llu", total, (total / 100) * ((m * 37 + k) % 100));
+        snprintf(key, sizeof(key), "statvfs:/mnt/data%03d", m);
+        record_bytes(key, buf, n);
+    }
+}
+
+static void gen_speeds(int ifaces) {
+    static const char *mbps[] = { "1000\n", "10000\n", "25000\n" };
+    char path[64];
+    for (int n = 0; n < ifaces; n++) {
+        snprintf(path, sizeof(path), "/sys/class/net/veth%04d/speed", n);
+        record_bytes(path, mbps[n % 3], strlen(mbps[n % 3]));
+    }
+}
+
+static void add_source(const char *path, strbuf_t *sb) {
+    proc_src_t src = { .fd = -1, .path = path, .buf = sb->buf, .len = sb->len };
+    record_source(&src);
+    sb->len = 0;
+}
+
+/* Records SYNTH_TICKS ticks through the --record writer and opens the
+ * capture for replay. Returns the offset of the first tick. */
+static size_t synth_capture(int cores, int ifaces, int mounts) {
+    char dir[] = "/tmp/umon-bench-XXXXXX";
+    if (!mkdtemp(dir) || record_open(dir) != 0) {
+        perror("bench_hotpath: capture");
+        exit(1);
+    }
+    strbuf_t sb = { NULL, 0, 0 };
+    for (int k = 0; k <= SYNTH_TICKS; k++) {
+        if (k > 0) record_tick(1000.0 + k);
+        gen_stat(&sb, cores, k);
+        add_source("/proc/stat", &sb);
+        gen_meminfo(&sb, k);
+        add_source("/proc/meminfo", &sb);
+        gen_mounts(&sb, mounts);
+        add_source("/proc/self/mounts", &sb);
+        if (k > 0) gen_statvfs(mounts, k);
+        gen_diskstats(&sb, mounts, k);
+        add_source("/proc/diskstats", &sb);
+        gen_netdev(&sb, ifaces, k);
+        add_source("/proc/net/dev", &sb);
+        if (k > 0) gen_speeds(ifaces);
+    }
+    record_opts.collectors = RECORD_CPU | RECORD_MEM | RECORD_DISKS | RECORD_NET | RECORD_NET_SAMPLED;
+    record_opts.cores = cores;
+    record_flush(1000.0, 1700000000.0);
+    record_close();
+    free(sb.buf);
+
+    if (replay_open(dir) != 0) {
+        perror("bench_hotpath: replay");
+        exit(1);
+    }
+    char path[64];
+    snprintf(path, sizeof(path), "%s/capture.umr", dir);
+    unlink(path);
+    rmdir(dir);
+    mono_anchor = replay_mono_anchor;
+    wall_anchor = replay_wall_anchor;
+    return replay_pos;
+}
+
+/* Fixed screen geometry instead of /dev/null's lack of one */
+static void bench_screen(void) {
+    fb_resize();
+    fb_resized = 0;
+    fb_rows = BENCH_ROWS;
+    fb_cols = BENCH_COLS;
+    fb_full_redraw = 1;
+}
+
+
+/* One tick: collectors and deltas, then the frame */
+static void run_tick(cost_t *sample, cost_t *render) {
+    mark_t m = mark();
+    take_snapshot(snap, 1, 1, 1, 1);
+    compute_sample(&cur_sample, 1, 1, 1, 1);
+    history_push(&cur_sample, 1, 1, 1);
+    charge(sample, &m, 1);
+
+    m = mark();
+    render_frame(&cur_sample, 1, 1, 1, 1);
+    charge(render, &m, 1);
+    rotate_snapshots();
+}
+
+static void emit_tick(const char *prefix, const char *params, const cost_t *sample, const cost_t *render) {
+    char name[64];
+    cost_t total = { sample->ops, sample->ns + render->ns, sample->allocs + render->allocs,
+                     sample->syscalls + render->syscalls };
+    snprintf(name, sizeof(name), "%stick_sample", prefix);
+    emit(name, params, sample);
+    snprintf(name, sizeof(name), "%srender_frame", prefix);
+    emit(name, params, render);
+    snprintf(name, sizeof(name), "%stick", prefix);
+    emit(name, params, &total);
+}
+
+typedef struct {
+    char **lines;
+    int count;
+} lines_arg_t;
+
+static void op_parse_cpu_line(void *arg, long n) {
+    lines_arg_t *a = arg;
+    cpu_stats_t st;
+    for (long k = 0; k < n; k++) {
+        parse_cpu_line(a->lines[k % a->count], &st);
+        sink = st.user;
+    }
+}
+
+typedef struct {
+    const char *buf;
+    cpu_table_t table;
+} stat_arg_t;
+
+static void op_parse_proc_stat(void *arg, long n) {
+    stat_arg_t *a = arg;
+    cpu_stats_t total;
+    for (long k = 0; k < n; k++) sink = parse_proc_stat(a->buf, &total, &a->table);
+}
+
+static void op_net_dev_parse(void *arg, long n) {
+    (void)arg;
+    for (long k = 0; k < n; k++) {
+        snap->net_count = 0;
+        sample_net_procfs(snap);
+    }
+    sink = snap->net_count;
+}
+
+static void op_calculate_cpu_percent(void *arg, long n) {
+    (void)arg;
+    cpu_stats_t prev = { 1000, 0, 500, 9000, 10, 0, 0, 0 };
+    cpu_stats_t curr = prev;
+    for (long k = 0; k < n; k++) {
+        curr.user = prev.user + 20 + (k & 63);
+        curr.idle = prev.idle + 80 - (k & 63);
+        sink = calculate_cpu_percent(&curr, &prev);
+    }
+}
+
+static void op_draw_bar_ascii(void *arg, long n) {
+    (void)arg;
+    char buf[256];
+    for (long k = 0; k < n; k++) {
+        draw_bar_ascii((double)(k % 101), 100.0, 30, buf, sizeof(buf));
+        sink = buf[0];
+    }
+}
+
+static void op_format_bytes(void *arg, long n) {
+    (void)arg;
+    char buf[32];
+    double v = 1;
+    for (long k = 0; k < n; k++) {
+        format_bytes(v, buf, sizeof(buf));
+        v = v < 1e16 ? v * 7.3 : 1;
+        sink = buf[0];
+    }
+}
+
+/* Runs in a child: every case of one synthetic host size */
+static void bench_size(int cores, int ifaces, int mounts) {
+    char params[128];
+    strbuf_t sb = { NULL, 0, 0 };
+
+    gen_stat(&sb, cores, 1);
+    lines_arg_t la = { calloc(cores + 1, sizeof(char *)), 0 };
+    char *text = strdup(sb.buf), *pos = text, *line;
+    while ((line = src_next_line(&pos)) != NULL && strncmp(line, "cpu", 3) == 0) la.lines[la.count++] = line;
+    cost_t c = measure(op_parse_cpu_line, &la);
+    snprintf(params, sizeof(params), ",\"cores\":%d", cores);
+    emit("parse_cpu_line", params, &c);
+
+    stat_arg_t sa = { sb.buf, { 0 } };
+    cpu_table_init(&sa.table, cores);
+    c = measure(op_parse_proc_stat, &sa);
+    emit("parse_proc_stat", params, &c);
+
+    num_cores = cores;
+    cpu_table_init(&snapshots[0].cores, cores);
+    cpu_table_init(&snapshots[1].cores, cores);
+    cur_sample.cpu_cores = calloc(cores, sizeof(double));
+    history_init();
+    src_open(&src_stat, "/proc/stat", 0);
+    src_open(&src_meminfo, "/proc/meminfo", 0);
+    src_open(&src_netdev, "/proc/net/dev", 1);
+    src_open(&src_diskstats, "/proc/diskstats", 1);
+    src_open(&src_mounts, "/proc/self/mounts", 1);
+    for (int d = 0; d < mounts; d++) {
+        diskio_kind_t *k = &diskio_kinds[diskio_kind_count++];
+        snprintf(k->name, sizeof(k->name), "bd%03d", d);
+        k->whole = 1;
+    }
+
+    size_t first_tick = synth_capture(cores, ifaces, mounts);
+    wheel_init();
+    sample_cpu(snap_prev);
+    replay_next_tick();
+    c = measure(op_net_dev_parse, NULL);
+    snprintf(params, sizeof(params), ",\"ifaces\":%d", ifaces);
+    emit("net_dev_parse", params, &c);
+
+    /* Warm-up pass over the whole capture, then whole passes until
+     * BENCH_MIN_NS of ticks have been measured */
+    bench_screen();
+    cost_t warm_s = { 0, 0, 0, 0 }, warm_r = { 0, 0, 0, 0 };
+    cost_t sample = { 0, 0, 0, 0 }, render = { 0, 0, 0, 0 };
+    int tick = 0;
+    for (int pass = 0; pass < 2 || sample.ns + render.ns < BENCH_MIN_NS; pass++) {
+        replay_pos = first_tick;
+        while (replay_next_tick() == 0) {
+            replay_now = 1000.0 + ++tick;
+            run_tick(pass ? &sample : &warm_s, pass ? &render : &warm_r);
+        }
+    }
+    snprintf(params, sizeof(params), ",\"cores\":%d,\"ifaces\":%d,\"mounts\":%d", cores, ifaces, mounts);
+    emit_tick("", params, &sample, &render);
+
+    free(text);
+    free(sb.buf);
+}
+
+/* Runs in a child: ticks back to back on this host's /proc */
+static void bench_live(int cores, int ifaces, int mounts) {
+    (void)cores;
+    (void)ifaces;
+    (void)mounts;
+    init_sampling();
+    history_init();
+    sched_init(1000);
+    wheel_init();
+    mounts_init();
+    bench_screen();
+    cost_t warm_s = { 0, 0, 0, 0 }, warm_r = { 0, 0, 0, 0 };
+    cost_t sample = { 0, 0, 0, 0 }, render = { 0, 0, 0, 0 };
+    for (int t = 0; t < 3; t++) run_tick(&warm_s, &warm_r);
+    for (int t = 0; t < LIVE_TICKS; t++) run_tick(&sample, &render);
+
+    char params[128];
+    snprintf(params, sizeof(params), ",\"cores\":%d,\"ifaces\":%d,\"mounts\":%d,\"netlink\":%d",
+             num_cores, snap_prev->net_count, mount_count, nl_fd >= 0);
+    emit_tick("live_", params, &sample, &render);
+}
+
+/* Runs a case in a child so that it starts from umon's initial state */
+static void in_child(const char *what, void (*fn)(int, int, int), int cores, int ifaces, int mounts) {
+    pid_t pid = fork();
+    if (pid == 0) {
+        fn(cores, ifaces, mounts);
+        _exit(0);
+    }
+    int status;
+    if (pid < 0 || waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "bench_hotpath: %s cores=%d ifaces=%d mounts=%d failed\n", what, cores, ifaces, mounts);
+        exit(1);
+    }
+}
+
+int main(void) {
+    /* Frames go to /dev/null; results to the original stdout */
+    out_fd = dup(STDOUT_FILENO);
+    int null_fd = open("/dev/null", O_WRONLY);
+    if (out_fd < 0 || null_fd < 0 || dup2(null_fd, STDOUT_FILENO) < 0) {
+        perror("bench_hotpath");
+        return 1;
+    }
+    close(null_fd);
+
+    dprintf(out_fd, "{\"bench\":\"meta\",\"version\":\"%s\",\"rows\":%d,\"cols\":%d,\"host_cpus\":%ld}\n",
+            __CODEVERSION__, BENCH_ROWS, BENCH_COLS, sysconf(_SC_NPROCESSORS_ONLN));
+
+    cost_t c = measure(op_calculate_cpu_percent, NULL);
+    emit("calculate_cpu_percent", "", &c);
+    c = measure(op_draw_bar_ascii, NULL);
+    emit("draw_bar_ascii", "", &c);
+    c = measure(op_format_bytes, NULL);
+    emit("format_bytes", "", &c);
+
+    in_child("synthetic", bench_size, 8, 4, 4);
+    in_child("synthetic", bench_size, 64, 100, 16);
+    in_child("synthetic", bench_size, 256, 1000, 64);
+    in_child("live", bench_live, 0, 0, 0);
+    return 0;
+}
@@ -0,0 +1,111 @@
+/* Micro-benchmark: /proc/stat parsing, sscanf line parser vs tokenizer.
+ *
+ * Build and run with `make bench`. Fixtures in bench/fixtures are /proc/stat
+ * dumps in kernel format with 8, 64 and 512 cores.
+ */
+#define UMON_NO_MAIN
+#include "../umon.c"
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static char *load_file(const char *path, size_t *len) {
+    FILE *f = fopen(path, "r");
+    if (!f) return NULL;
+    fseek(f, 0, SEEK_END);
+    long sz = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    char *buf = malloc(sz + 1);
+    if (!buf || fread(buf, 1, sz, f) != (size_t)sz) {
+        fclose(f);
+        free(buf);
+        return NULL;
+    }
+    buf[sz] = '\0';
+    fclose(f);
+    *len = sz;
+    return buf;
+}
+
+/* The pre-tokenizer per-tick path: fgets over the file, sscanf per cpu line
+ * and a calloc/free of the core array. */
+static void legacy_parse(const char *buf, size_t len, int cores, cpu_stats_t *total, cpu_stats_t *out) {
+    FILE *f = fmemopen((void *)buf, len, "r");
+    cpu_stats_t *curr_cores = calloc(cores, sizeof(cpu_stats_t));
+    char line[512];
+    int core_idx = 0;
+    while (fgets(line, sizeof(line), f)) {
+        if (strncmp(line, "cpu ", 4) == 0) {
+            parse_cpu_line(line, total);
+        } else if (strncmp(line, "cpu", 3) == 0 && isdigit(line[3])) {
+            if (core_idx < cores) {
+                parse_cpu_line(line, &curr_cores[core_idx]);
+                core_idx++;
+            }
+        }
+    }
+    fclose(f);
+    memcpy(out, curr_cores, cores * sizeof(cpu_stats_t));
+    free(curr_cores);
+}
+
+static int bench_fixture(const char *dir, int cores) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s/proc_stat_%d.txt", dir, cores);
+    size_t len;
+    char *buf = load_file(path, &len);
+    if (!buf) {
+        fprintf(stderr, "cannot read %s\n", path);
+        return 1;
+    }
+
+    cpu_stats_t legacy_total, *legacy_cores = calloc(cores, sizeof(cpu_stats_t));
+    cpu_stats_t tok_total;
+    cpu_table_t table;
+    cpu_table_init(&table, cores);
+
+    /* Both parsers must agree before timing means anything */
+    legacy_parse(buf, len, cores, &legacy_total, legacy_cores);
+    parse_proc_stat(buf, &tok_total, &table);
+    if (table.n != cores || memcmp(&legacy_total, &tok_total, sizeof(cpu_stats_t)) != 0) {
+        fprintf(stderr, "%s: parser mismatch\n", path);
+        return 1;
+    }
+    for (int i = 0; i < cores; i++) {
+        cpu_stats_t c;
+        cpu_table_get(&table, i, &c);
+        if (memcmp(&c, &legacy_cores[i], sizeof(c)) != 0) {
+            fprintf(stderr, "%s: core %d mismatch\n", path, i);
+            return 1;
+        }
+    }
+
+    int iters = 200000 / cores + 100;
+    double t0 = now_ns();
+    for (int i = 0; i < iters; i++) legacy_parse(buf, len, cores, &legacy_total, legacy_cores);
+    double t1 = now_ns();
+    for (int i = 0; i < iters; i++) parse_proc_stat(buf, &tok_total, &table);
+    double t2 = now_ns();
+
+    double legacy_ns = (t1 - t0) / iters;
+    double tok_ns = (t2 - t1) / iters;
+    printf("proc_stat cores=%-4d sscanf=%10.0f ns/parse  tokenizer=%9.0f ns/parse  speedup=%.1fx\n",
+           cores, legacy_ns, tok_ns, legacy_ns / tok_ns);
+
+    free(legacy_cores);
+    free(table.user);
+    free(buf);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    const char *dir = argc > 1 ? argv[1] : "bench/fixtures";
+    int rc = 0;
+    rc |= bench_fixture(dir, 8);
+    rc |= bench_fixture(dir, 64);
+    rc |= bench_fixture(dir, 512);
+    return rc;
+}
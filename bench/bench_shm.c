@@ -0,0 +1,84 @@
+/* Seqlock check: readers of the --shm segment must never see a torn tick.
+ *
+ * Build and run with `make bench`. A writer thread publishes as fast as it
+ * can through shm_publish(), with every CPU column of a tick holding the
+ * same value, while the main thread reads through umon_shm_read() on a
+ * separate mapping. Any read whose columns disagree is torn; the run fails
+ * if one is found.
+ */
+#define UMON_NO_MAIN
+#include "../umon.c"
+
+#define SHM_CORES 255
+#define SHM_SECONDS 1.0
+
+static volatile int writer_stop = 0;
+static unsigned long long writes = 0;
+
+static void *writer_main(void *arg) {
+    sample_t *s = arg;
+    double v = 0;
+    while (!__atomic_load_n(&writer_stop, __ATOMIC_RELAXED)) {
+        v += 1;
+        s->cpu_total = v;
+        for (int i = 0; i < num_cores; i++) s->cpu_cores[i] = v;
+        s->wall = v;
+        shm_publish(s);
+        writes++;
+    }
+    return NULL;
+}
+
+int main(void) {
+    char name[64];
+    snprintf(name, sizeof(name), "umon-bench-%d", (int)getpid());
+
+    num_cores = SHM_CORES;
+    sample_t s;
+    memset(&s, 0, sizeof(s));
+    s.cpu_cores = calloc(num_cores, sizeof(double));
+    build_log_schema(&s, 1, 0, 0, 0);
+    if (shm_create(name) != 0) {
+        perror("shm_create");
+        return 1;
+    }
+    size_t size;
+    const umon_shm_header_t *h = umon_shm_attach(name, &size);
+    if (!h || h->col_count != (uint32_t)log_col_count) {
+        fprintf(stderr, "shm: cannot attach to %s\n", name);
+        shm_close();
+        return 1;
+    }
+
+    pthread_t writer;
+    pthread_create(&writer, NULL, writer_main, &s);
+
+    double *values = malloc(h->col_count * sizeof(double));
+    unsigned long long reads = 0, busy = 0, torn = 0;
+    struct timespec t0, t;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    do {
+        uint64_t tick;
+        double wall;
+        if (umon_shm_read(h, values, &tick, &wall, 1) != 0) {
+            busy++;
+        } else {
+            reads++;
+            for (uint32_t i = 0; i < h->col_count; i++) {
+                if (values[i] != wall) {
+                    torn++;
+                    break;
+                }
+            }
+        }
+        clock_gettime(CLOCK_MONOTONIC, &t);
+    } while ((t.tv_sec - t0.tv_sec) + (t.tv_nsec - t0.tv_nsec) / 1e9 < SHM_SECONDS);
+
+    __atomic_store_n(&writer_stop, 1, __ATOMIC_RELAXED);
+    pthread_join(writer, NULL);
+    shm_close();
+
+    printf("shm cols=%d writes=%llu reads=%llu retried=%llu torn=%llu\n",
+           log_col_count, writes, reads, busy, torn);
+    return torn != 0 || reads == 0;
+}
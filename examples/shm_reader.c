@@ -0,0 +1,52 @@
+/* Minimal consumer of umon's shared-memory snapshot.
+ *
+ *   umon --daemon --interval 100 --shm umon &
+ *   ./examples/shm_reader umon [INTERVAL_MS]
+ *
+ * Prints every column of each new tick, and waits for the next run when
+ * umon exits. Only umon_shm.h is needed; there is nothing to link against.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "../umon_shm.h"
+
+int main(int argc, char **argv) {
+    const char *name = argc > 1 ? argv[1] : "umon";
+    int interval_ms = argc > 2 ? atoi(argv[2]) : 100;
+    size_t size;
+    const umon_shm_header_t *h = umon_shm_attach(name, &size);
+    if (!h) {
+        fprintf(stderr, "no umon segment '%s' (is umon running with --shm %s?)\n", name, name);
+        return 1;
+    }
+
+    double *values = malloc(h->col_count * sizeof(double));
+    if (!values) return 1;
+    uint64_t last = 0;
+    struct timespec pause = { interval_ms / 1000, (interval_ms % 1000) * 1000000L };
+    for (;;) {
+        uint64_t tick = 0;
+        double wall = 0;
+        int rc = umon_shm_read(h, values, &tick, &wall, 1000);
+        if (rc == UMON_SHM_GONE) {
+            munmap((void *)h, size);
+            fprintf(stderr, "umon exited; waiting for '%s'\n", name);
+            while (!(h = umon_shm_attach(name, &size))) nanosleep(&pause, NULL);
+            free(values);
+            values = malloc(h->col_count * sizeof(double));
+            if (!values) return 1;
+            last = 0;
+            continue;
+        }
+        if (rc == 0 && tick != last) {
+            last = tick;
+            printf("tick %llu at %.3f\n", (unsigned long long)tick, wall);
+            for (uint32_t i = 0; i < h->col_count; i++) {
+                printf("  %-40s %.2f\n", umon_shm_col_name(h, i), values[i]);
+            }
+            fflush(stdout);
+        }
+        nanosleep(&pause, NULL);
+    }
+}
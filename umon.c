@@ -2,7 +2,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdarg.h>
+#include <errno.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <time.h>
 #include <sys/time.h>
 #include <sys/statvfs.h>
@@ -12,14 +15,31 @@
 #include <ifaddrs.h>
 #include <netdb.h>
 #include <linux/if_link.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
 #include <sys/ioctl.h>
 #include <net/if.h>
 #include <ctype.h>
 #include <mntent.h>
 #include <math.h>
 #include <signal.h>
+#include <pthread.h>
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#include <stdint.h>
+#include <sys/timerfd.h>
+#include <sys/epoll.h>
+#include <poll.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 #include <netpacket/packet.h>
 
+#include "umon_shm.h"
+
 /* Program Information */
 #define __CODEVERSION__ "0.0.3"
 #define __CODEAUTHOR__ "Igor Brzezek"
@@ -49,8 +69,24 @@ typedef struct {
     unsigned long long steal;
 } cpu_stats_t;
 
+/* Per-core counters stored as one array per field, filled in place by
+ * parse_proc_stat() without any allocation after cpu_table_init() */
+typedef struct {
+    int n;
+    int cap;
+    unsigned long long *user;
+    unsigned long long *nice;
+    unsigned long long *system;
+    unsigned long long *idle;
+    unsigned long long *iowait;
+    unsigned long long *irq;
+    unsigned long long *softirq;
+    unsigned long long *steal;
+} cpu_table_t;
+
 typedef struct {
     char name[32];
+    int ifindex;
     unsigned long long bytes_sent;
     unsigned long long bytes_recv;
 } net_stats_t;
@@ -64,9 +100,14 @@ int opt_net_all = 0;
 int opt_cpulist = 0;
 int opt_mono = 0;
 int opt_interval = 250;
+int opt_frame_stats = 0;
+int opt_daemon = 0;
+char *opt_listen = NULL;
+char *opt_shm = NULL;
 char *opt_log = NULL;
-FILE *log_fp = NULL;
+int log_fd = -1;
 int log_header_written = 0;
+volatile sig_atomic_t stop_requested = 0;
 
 /* Helpers */
 const char* c_red(void) { return opt_mono ? "" : RED; }
@@ -123,6 +164,270 @@ void draw_bar_ascii(double value, double max_val, int width, char *buffer, size_
              c_cyan(), c_reset(), bar, c_cyan(), c_reset(), pct);
 }
 
+/* Growable byte buffer, reused across ticks so steady state does not allocate */
+typedef struct {
+    char *buf;
+    size_t len;
+    size_t cap;
+} strbuf_t;
+
+int sb_reserve(strbuf_t *sb, size_t extra) {
+    if (sb->len + extra + 1 <= sb->cap) return 0;
+    size_t ncap = sb->cap ? sb->cap : 4096;
+    while (ncap < sb->len + extra + 1) ncap *= 2;
+    char *nb = realloc(sb->buf, ncap);
+    if (!nb) return -1;
+    sb->buf = nb;
+    sb->cap = ncap;
+    return 0;
+}
+
+void sb_append(strbuf_t *sb, const char *data, size_t n) {
+    if (sb_reserve(sb, n) != 0) return;
+    memcpy(sb->buf + sb->len, data, n);
+    sb->len += n;
+    sb->buf[sb->len] = '\0';
+}
+
+void sb_vprintf(strbuf_t *sb, const char *fmt, va_list ap) {
+    va_list ap2;
+    va_copy(ap2, ap);
+    if (sb_reserve(sb, 256) != 0) {
+        va_end(ap2);
+        return;
+    }
+    int n = vsnprintf(sb->buf + sb->len, sb->cap - sb->len, fmt, ap);
+    if (n >= 0 && (size_t)n >= sb->cap - sb->len) {
+        if (sb_reserve(sb, n) == 0) vsnprintf(sb->buf + sb->len, sb->cap - sb->len, fmt, ap2);
+    }
+    if (n > 0 && sb->len + n < sb->cap) sb->len += n;
+    va_end(ap2);
+}
+
+void sb_printf(strbuf_t *sb, const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    sb_vprintf(sb, fmt, ap);
+    va_end(ap);
+}
+
+/* Frame Buffer Renderer
+ * A frame is printed as ANSI text into fb_text, parsed into a grid of cells
+ * and compared with the previous frame. Only cells that changed are sent,
+ * addressed with cursor moves, in a single write() per frame. */
+#define ATTR_BOLD 1
+#define ATTR_DIM  2
+
+typedef struct {
+    char ch[4];
+    unsigned char len;
+    unsigned char fg;
+    unsigned char attr;
+} cell_t;
+
+strbuf_t fb_text;
+strbuf_t fb_out;
+cell_t *fb_prev = NULL;
+cell_t *fb_next = NULL;
+int fb_rows = 0;
+int fb_cols = 0;
+int fb_full_redraw = 1;
+int fb_plain = 0;
+volatile sig_atomic_t fb_resized = 1;
+unsigned char fb_cur_fg = 0;
+unsigned char fb_cur_attr = 0;
+
+size_t fb_last_bytes = 0;
+unsigned long long fb_total_bytes = 0;
+unsigned long long fb_frames = 0;
+
+void fb_printf(const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    sb_vprintf(&fb_text, fmt, ap);
+    va_end(ap);
+}
+
+void fb_repeat(char c, int n) {
+    if (n <= 0 || sb_reserve(&fb_text, n) != 0) return;
+    memset(fb_text.buf + fb_text.len, c, n);
+    fb_text.len += n;
+    fb_text.buf[fb_text.len] = '\0';
+}
+
+void handle_winch(int sig) {
+    (void)sig;
+    fb_resized = 1;
+}
+
+/* Re-reads the terminal size and forces a full redraw */
+void fb_resize(void) {
+    struct winsize ws;
+    int rows = 1024, cols = 256;
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_row > 0 && ws.ws_col > 0) {
+        rows = ws.ws_row;
+        cols = ws.ws_col;
+    }
+    if (rows * cols > fb_rows * fb_cols) {
+        cell_t *p = realloc(fb_prev, (size_t)rows * cols * sizeof(cell_t));
+        if (!p) return;
+        fb_prev = p;
+        cell_t *n = realloc(fb_next, (size_t)rows * cols * sizeof(cell_t));
+        if (!n) return;
+        fb_next = n;
+    }
+    fb_rows = rows;
+    fb_cols = cols;
+    fb_full_redraw = 1;
+}
+
+void fb_clear(cell_t *cells) {
+    cell_t blank = { {' '}, 1, 0, 0 };
+    for (int i = 0; i < fb_rows * fb_cols; i++) cells[i] = blank;
+}
+
+/* Applies the parameters of an SGR sequence to the running colour state */
+void fb_apply_sgr(const char *p, const char *end, unsigned char *fg, unsigned char *attr) {
+    if (p == end) {
+        *fg = 0;
+        *attr = 0;
+        return;
+    }
+    while (p <= end) {
+        int v = 0;
+        while (p < end && isdigit((unsigned char)*p)) v = v * 10 + (*p++ - '0');
+        if (v == 0) { *fg = 0; *attr = 0; }
+        else if (v == 1) *attr |= ATTR_BOLD;
+        else if (v == 2) *attr |= ATTR_DIM;
+        else if (v == 22) *attr = 0;
+        else if (v == 39) *fg = 0;
+        else if ((v >= 30 && v <= 37) || (v >= 90 && v <= 97)) *fg = (unsigned char)v;
+        p++;
+    }
+}
+
+/* Lays out fb_text into the cell grid, clipping to the terminal size */
+void fb_layout(cell_t *cells) {
+    const char *p = fb_text.buf ? fb_text.buf : "";
+    const char *end = p + fb_text.len;
+    int r = 0, c = 0;
+    unsigned char fg = 0, attr = 0;
+    
+    fb_clear(cells);
+    while (p < end && r < fb_rows) {
+        unsigned char ch = (unsigned char)*p;
+        if (ch == '\n') {
+            r++;
+            c = 0;
+            p++;
+        } else if (ch == '\033' && p + 1 < end && p[1] == '[') {
+            const char *q = p + 2;
+            while (q < end && ((*q >= '0' && *q <= '9') || *q == ';' || *q == '?')) q++;
+            if (q < end && *q == 'm') fb_apply_sgr(p + 2, q, &fg, &attr);
+            p = (q < end) ? q + 1 : end;
+        } else if (ch < 0x20) {
+            p++;
+        } else {
+            int len = (ch >= 0xF0) ? 4 : (ch >= 0xE0) ? 3 : (ch >= 0xC0) ? 2 : 1;
+            if (p + len > end) break;
+            if (c < fb_cols) {
+                cell_t *cell = &cells[r * fb_cols + c];
+                memcpy(cell->ch, p, len);
+                cell->len = (unsigned char)len;
+                cell->fg = opt_mono ? 0 : fg;
+                cell->attr = opt_mono ? 0 : attr;
+            }
+            c++;
+            p += len;
+        }
+    }
+}
+
+void fb_emit_cell(const cell_t *cell) {
+    if (cell->fg != fb_cur_fg || cell->attr != fb_cur_attr) {
+        char sgr[32];
+        int n = snprintf(sgr, sizeof(sgr), "\033[0%s%s", (cell->attr & ATTR_BOLD) ? ";1" : "", (cell->attr & ATTR_DIM) ? ";2" : "");
+        if (cell->fg) n += snprintf(sgr + n, sizeof(sgr) - n, ";%d", cell->fg);
+        sgr[n++] = 'm';
+        sb_append(&fb_out, sgr, n);
+        fb_cur_fg = cell->fg;
+        fb_cur_attr = cell->attr;
+    }
+    sb_append(&fb_out, cell->ch, cell->len);
+}
+
+int fb_cell_eq(const cell_t *a, const cell_t *b) {
+    return a->len == b->len && a->fg == b->fg && a->attr == b->attr && memcmp(a->ch, b->ch, a->len) == 0;
+}
+
+/* Diffs the frame printed since the last call against the one on screen and
+ * writes the changes. Returns the number of bytes sent to the terminal. */
+size_t fb_flush(void) {
+    if (fb_plain) {
+        sb_append(&fb_text, "\n", 1);
+        size_t n = fwrite(fb_text.buf, 1, fb_text.len, stdout);
+        fflush(stdout);
+        fb_text.len = 0;
+        fb_last_bytes = n;
+        fb_total_bytes += n;
+        fb_frames++;
+        return n;
+    }
+    if (fb_resized) {
+        fb_resized = 0;
+        fb_resize();
+    }
+    fb_out.len = 0;
+    if (!fb_prev || !fb_next) return 0;
+    
+    if (fb_full_redraw) {
+        sb_append(&fb_out, "\033[0m\033[H\033[2J", 11);
+        fb_cur_fg = fb_cur_attr = 0;
+        fb_clear(fb_prev);
+        fb_full_redraw = 0;
+    }
+    fb_layout(fb_next);
+    
+    for (int r = 0; r < fb_rows; r++) {
+        int cur_c = -1;
+        for (int c = 0; c < fb_cols; c++) {
+            const cell_t *cell = &fb_next[r * fb_cols + c];
+            if (fb_cell_eq(cell, &fb_prev[r * fb_cols + c])) continue;
+            
+            /* Re-sending a short run of unchanged cells is cheaper than a cursor move */
+            if (cur_c >= 0 && c > cur_c && c - cur_c <= 4) {
+                for (; cur_c < c; cur_c++) fb_emit_cell(&fb_next[r * fb_cols + cur_c]);
+            } else if (cur_c != c) {
+                char mv[24];
+                int n = snprintf(mv, sizeof(mv), "\033[%d;%dH", r + 1, c + 1);
+                sb_append(&fb_out, mv, n);
+            }
+            fb_emit_cell(cell);
+            cur_c = c + 1;
+        }
+    }
+    
+    size_t off = 0;
+    while (off < fb_out.len) {
+        ssize_t n = write(STDOUT_FILENO, fb_out.buf + off, fb_out.len - off);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        off += n;
+    }
+    
+    cell_t *t = fb_prev;
+    fb_prev = fb_next;
+    fb_next = t;
+    fb_text.len = 0;
+    
+    fb_last_bytes = fb_out.len;
+    fb_total_bytes += fb_out.len;
+    fb_frames++;
+    return fb_out.len;
+}
+
 /* System Info */
 void display_sysinfo(void) {
     struct utsname un;
@@ -337,478 +642,4651 @@ void display_netlist(void) {
     exit(0);
 }
 
-/* Core Monitoring Functions */
+/* Sampling Layer */
 
-void parse_cpu_line(const char *line, cpu_stats_t *stats) {
-    sscanf(line, "%*s %llu %llu %llu %llu %llu %llu %llu %llu",
-           &stats->user, &stats->nice, &stats->system,
-           &stats->idle, &stats->iowait, &stats->irq,
-           &stats->softirq, &stats->steal);
+/* A procfs/sysfs file that is opened once at startup and re-read in place
+ * with pread() at offset 0 on every tick. Sources backed by seq_file
+ * iterators (/proc/net/dev) hand out at most a page per read and are marked
+ * chunked, so they are read until EOF. Single-record sources (/proc/stat,
+ * /proc/meminfo, sysfs attributes) are complete after the first short read. */
+typedef struct {
+    const char *path;
+    int fd;
+    int chunked;
+    char *buf;
+    size_t cap;
+    size_t len;
+} proc_src_t;
+
+/* Record and Replay
+ * --record DIR appends the bytes of every successful src_read() to
+ * DIR/capture.umr, grouped by tick; --replay DIR serves them back to the
+ * same parsers instead of the files and runs the ticks back to back with
+ * the recorded timestamps. The header keeps the collectors, periods and
+ * interface filter the capture was taken with, and replay runs with those.
+ * Whatever else a tick depends on goes into the capture as well: link
+ * speeds and /sys/block checks (src_read_once(), src_exists()), the time
+ * each collector read its source (sample_clock()) and the statvfs verdict
+ * of every mount. A replay never looks at the host, so rates come out as
+ * they did live and a replayed --log is byte-for-byte repeatable.
+ * Recording reads interfaces from /proc/net/dev instead of rtnetlink;
+ * --procs, --cgroup and PSI triggers are not captured.
+ *
+ *   "UMONREC\0"  u32 version  u32 collectors  f64 mono anchor  f64 wall anchor
+ *   u32 cores  u32 period[RECORD_PERIODS]  char net_iface[32]
+ *   'T' f64 tick time                          starts a tick
+ *   'S' u16 path length, path, u32 length, bytes   one source read
+ *
+ * Reads before the first 'T' are the baseline taken at startup. */
+#define RECORD_MAGIC "UMONREC"
+#define RECORD_VERSION 2
+#define RECORD_HEADER 88
+#define RECORD_PERIODS 5        /* COLL_COUNT */
+
+/* Collector bits of the header */
+#define RECORD_CPU 0x01
+#define RECORD_MEM 0x02
+#define RECORD_DISKS 0x04
+#define RECORD_NET 0x08         /* interfaces shown and logged */
+#define RECORD_NET_SAMPLED 0x10 /* interfaces read, e.g. only for --listen */
+#define RECORD_PSI 0x20
+
+typedef struct {
+    uint32_t collectors;
+    uint32_t cores;
+    uint32_t period[RECORD_PERIODS];
+    char net_iface[32];
+} capture_opts_t;
+
+char *opt_record = NULL;
+char *opt_replay = NULL;
+int record_fd = -1;
+int record_header_done = 0;
+strbuf_t record_buf;
+unsigned long long record_ticks = 0;
+capture_opts_t record_opts;
+
+int replay_active = 0;
+const unsigned char *replay_data = NULL;
+size_t replay_size = 0;
+size_t replay_pos = 0;          /* start of the next tick */
+size_t replay_seg = 0;          /* first record of the current tick */
+size_t replay_seg_end = 0;
+size_t replay_hint = 0;         /* where the last lookup matched */
+double replay_now = 0;
+double replay_mono_anchor = 0, replay_wall_anchor = 0;
+capture_opts_t replay_opts;
+unsigned long long replay_ticks = 0;
+
+int record_open(const char *dir) {
+    char path[4096];
+    if (mkdir(dir, 0755) != 0 && errno != EEXIST) return -1;
+    snprintf(path, sizeof(path), "%s/capture.umr", dir);
+    record_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    return record_fd < 0 ? -1 : 0;
 }
 
-double calculate_cpu_percent(cpu_stats_t *curr, cpu_stats_t *prev) {
-    unsigned long long prev_idle = prev->idle + prev->iowait;
-    unsigned long long curr_idle = curr->idle + curr->iowait;
-    
-    unsigned long long prev_non_idle = prev->user + prev->nice + prev->system + prev->irq + prev->softirq + prev->steal;
-    unsigned long long curr_non_idle = curr->user + curr->nice + curr->system + curr->irq + curr->softirq + curr->steal;
-    
-    unsigned long long prev_total = prev_idle + prev_non_idle;
-    unsigned long long curr_total = curr_idle + curr_non_idle;
-    
-    unsigned long long total_diff = curr_total - prev_total;
-    unsigned long long idle_diff = curr_idle - prev_idle;
-    
-    if (total_diff == 0) return 0.0;
-    
-    return ((double)(total_diff - idle_diff) / total_diff) * 100.0;
+void record_bytes(const char *path, const void *data, size_t size) {
+    uint16_t plen = (uint16_t)strlen(path);
+    uint32_t len = (uint32_t)size;
+    sb_append(&record_buf, "S", 1);
+    sb_append(&record_buf, (const char *)&plen, sizeof(plen));
+    sb_append(&record_buf, path, plen);
+    sb_append(&record_buf, (const char *)&len, sizeof(len));
+    sb_append(&record_buf, data, len);
 }
 
-cpu_stats_t cpu_prev_total;
-cpu_stats_t *cpu_prev_cores = NULL;
-int num_cores = 0;
+void record_source(const proc_src_t *src) {
+    record_bytes(src->path, src->buf, src->len);
+}
 
-void init_cpu_stats() {
-    num_cores = sysconf(_SC_NPROCESSORS_ONLN);
-    cpu_prev_cores = calloc(num_cores, sizeof(cpu_stats_t));
-    
-    FILE *f = fopen("/proc/stat", "r");
-    if (!f) return;
-    char line[512];
-    int core_idx = 0;
-    while (fgets(line, sizeof(line), f)) {
-        if (strncmp(line, "cpu ", 4) == 0) {
-            parse_cpu_line(line, &cpu_prev_total);
-        } else if (strncmp(line, "cpu", 3) == 0 && isdigit(line[3])) {
-            if (core_idx < num_cores) {
-                parse_cpu_line(line, &cpu_prev_cores[core_idx]);
-                core_idx++;
-            }
-        }
+void record_tick(double t) {
+    sb_append(&record_buf, "T", 1);
+    sb_append(&record_buf, (const char *)&t, sizeof(t));
+    record_ticks++;
+}
+
+/* Writes the buffered reads; the header goes first, once the clock
+ * anchors exist and record_opts is filled in */
+void record_flush(double mono_anchor, double wall_anchor) {
+    if (record_fd < 0) return;
+    if (!record_header_done) {
+        char hdr[RECORD_HEADER];
+        uint32_t version = RECORD_VERSION;
+        memcpy(hdr, RECORD_MAGIC, 8);
+        memcpy(hdr + 8, &version, 4);
+        memcpy(hdr + 12, &record_opts.collectors, 4);
+        memcpy(hdr + 16, &mono_anchor, 8);
+        memcpy(hdr + 24, &wall_anchor, 8);
+        memcpy(hdr + 32, &record_opts.cores, 4);
+        memcpy(hdr + 36, record_opts.period, sizeof(record_opts.period));
+        memcpy(hdr + 56, record_opts.net_iface, sizeof(record_opts.net_iface));
+        if (write(record_fd, hdr, sizeof(hdr)) != (ssize_t)sizeof(hdr)) return;
+        record_header_done = 1;
     }
-    fclose(f);
+    size_t off = 0;
+    while (off < record_buf.len) {
+        ssize_t n = write(record_fd, record_buf.buf + off, record_buf.len - off);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        off += n;
+    }
+    record_buf.len = 0;
 }
 
-void get_cpu_info(int bar_width) {
-    cpu_stats_t curr_total;
-    cpu_stats_t *curr_cores = calloc(num_cores, sizeof(cpu_stats_t));
-    char line[512];
-    
-    FILE *f = fopen("/proc/stat", "r");
-    if (!f) { free(curr_cores); return; }
-    
-    int core_idx = 0;
-    while (fgets(line, sizeof(line), f)) {
-        if (strncmp(line, "cpu ", 4) == 0) {
-            parse_cpu_line(line, &curr_total);
-        } else if (strncmp(line, "cpu", 3) == 0 && isdigit(line[3])) {
-            if (core_idx < num_cores) {
-                parse_cpu_line(line, &curr_cores[core_idx]);
-                core_idx++;
+void record_close(void) {
+    if (record_fd < 0) return;
+    close(record_fd);
+    record_fd = -1;
+}
+
+/* Walks one tick's records from *pos; returns the end of the tick */
+size_t replay_scan(size_t pos) {
+    while (pos < replay_size && replay_data[pos] == 'S') {
+        uint16_t plen;
+        uint32_t len;
+        if (pos + 3 > replay_size) return replay_size;
+        memcpy(&plen, replay_data + pos + 1, 2);
+        if (pos + 3 + plen + 4 > replay_size) return replay_size;
+        memcpy(&len, replay_data + pos + 3 + plen, 4);
+        if (pos + 7 + plen + (size_t)len > replay_size) return replay_size;
+        pos += 7 + plen + len;
+    }
+    return pos;
+}
+
+int replay_open(const char *dir) {
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/capture.umr", dir);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+    struct stat st;
+    void *p = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size >= RECORD_HEADER) p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) return -1;
+    uint32_t version;
+    memcpy(&version, (char *)p + 8, 4);
+    memcpy(&replay_opts.collectors, (char *)p + 12, 4);
+    memcpy(&replay_opts.cores, (char *)p + 32, 4);
+    memcpy(replay_opts.period, (char *)p + 36, sizeof(replay_opts.period));
+    memcpy(replay_opts.net_iface, (char *)p + 56, sizeof(replay_opts.net_iface));
+    replay_opts.net_iface[sizeof(replay_opts.net_iface) - 1] = '\0';
+    if (memcmp(p, RECORD_MAGIC, 8) != 0 || version != RECORD_VERSION ||
+        replay_opts.cores < 1 || replay_opts.cores > 65536) {
+        munmap(p, st.st_size);
+        errno = EINVAL;
+        return -1;
+    }
+    replay_data = p;
+    replay_size = st.st_size;
+    memcpy(&replay_mono_anchor, replay_data + 16, 8);
+    memcpy(&replay_wall_anchor, replay_data + 24, 8);
+    replay_hint = replay_seg = RECORD_HEADER;
+    replay_seg_end = replay_pos = replay_scan(RECORD_HEADER);
+    replay_active = 1;
+    return 0;
+}
+
+/* Moves to the next recorded tick; -1 at the end of the capture */
+int replay_next_tick(void) {
+    if (replay_pos + 9 > replay_size || replay_data[replay_pos] != 'T') return -1;
+    memcpy(&replay_now, replay_data + replay_pos + 1, 8);
+    replay_hint = replay_seg = replay_pos + 9;
+    replay_seg_end = replay_pos = replay_scan(replay_seg);
+    replay_ticks++;
+    return 0;
+}
+
+/* Finds this tick's record for path. Lookups come in the order the reads
+ * were recorded, so the search starts after the last match and wraps;
+ * a tick with thousands of link speeds stays linear. */
+int replay_find(const char *path, const unsigned char **data, uint32_t *len) {
+    size_t plen = strlen(path);
+    for (int pass = 0; pass < 2; pass++) {
+        size_t pos = pass ? replay_seg : replay_hint;
+        size_t end = pass ? replay_hint : replay_seg_end;
+        while (pos < end) {
+            uint16_t rplen;
+            memcpy(&rplen, replay_data + pos + 1, 2);
+            memcpy(len, replay_data + pos + 3 + rplen, 4);
+            size_t next = pos + 7 + rplen + *len;
+            if (rplen == plen && memcmp(replay_data + pos + 3, path, plen) == 0) {
+                *data = replay_data + pos + 7 + rplen;
+                replay_hint = next;
+                return 0;
             }
+            pos = next;
         }
     }
-    fclose(f);
-    
-    char buf[256];
-    
-    if (opt_cpulist) {
-        for (int i = 0; i < num_cores; i++) {
-            double pct = calculate_cpu_percent(&curr_cores[i], &cpu_prev_cores[i]);
-            draw_bar_ascii(pct, 100, bar_width, buf, sizeof(buf));
-            printf("CPU %2d: %s\n", i, buf);
-            cpu_prev_cores[i] = curr_cores[i];
+    return -1;
+}
+
+/* src_read() while replaying: this tick's bytes for the source's path */
+int replay_read(proc_src_t *src) {
+    const unsigned char *data;
+    uint32_t len;
+    src->len = 0;
+    if (replay_find(src->path, &data, &len) != 0) return -1;
+    if (len + 1 > src->cap) {
+        char *nb = realloc(src->buf, len + 1);
+        if (!nb) return -1;
+        src->buf = nb;
+        src->cap = len + 1;
+    }
+    memcpy(src->buf, data, len);
+    src->len = len;
+    src->buf[len] = '\0';
+    return 0;
+}
+
+void src_open(proc_src_t *src, const char *path, int chunked) {
+    src->path = path;
+    src->chunked = chunked;
+    /* Replay serves every read from the capture */
+    src->fd = replay_active ? -1 : open(path, O_RDONLY | O_CLOEXEC);
+    src->len = 0;
+    if (!src->buf) {
+        src->cap = 4096;
+        src->buf = malloc(src->cap);
+        if (!src->buf) src->cap = 0;
+    }
+}
+
+void src_close(proc_src_t *src) {
+    if (src->fd >= 0) close(src->fd);
+    src->fd = -1;
+    free(src->buf);
+    src->buf = NULL;
+    src->cap = src->len = 0;
+}
+
+/* Reads the whole source into src->buf and NUL-terminates it. The buffer
+ * only grows, so after the first few ticks no allocation happens here. */
+int src_read(proc_src_t *src) {
+    if (replay_active) return replay_read(src);
+    src->len = 0;
+    if (src->fd < 0 || !src->buf) return -1;
+    for (;;) {
+        if (src->len + 1 >= src->cap) {
+            char *nb = realloc(src->buf, src->cap * 2);
+            if (!nb) break;
+            src->buf = nb;
+            src->cap *= 2;
         }
-    } else {
-        double total_pct = calculate_cpu_percent(&curr_total, &cpu_prev_total);
-        draw_bar_ascii(total_pct, 100, bar_width, buf, sizeof(buf));
-        printf("%sCPU%s (%d cores): %s\n", c_blue(), c_reset(), num_cores, buf);
-        cpu_prev_total = curr_total;
-        
-        int cores_per_row = 3;
-        for (int i = 0; i < num_cores; i += cores_per_row) {
-            for (int j = i; j < i + cores_per_row && j < num_cores; j++) {
-                double pct = calculate_cpu_percent(&curr_cores[j], &cpu_prev_cores[j]);
-                draw_bar_ascii(pct, 100, bar_width, buf, sizeof(buf));
-                printf("%s#%2d:%s%s  ", c_white(), j, c_reset(), buf);
-                cpu_prev_cores[j] = curr_cores[j];
-            }
-            printf("\n");
+        ssize_t n = pread(src->fd, src->buf + src->len, src->cap - 1 - src->len, (off_t)src->len);
+        if (n < 0) {
+            src->len = 0;
+            src->buf[0] = '\0';
+            return -1;
         }
+        src->len += n;
+        if (n == 0 || (!src->chunked && src->len + 1 < src->cap)) break;
     }
-    
-    free(curr_cores);
+    src->buf[src->len] = '\0';
+    if (record_fd >= 0) record_source(src);
+    return 0;
 }
 
-void get_memory_info(int bar_width) {
-    FILE *f = fopen("/proc/meminfo", "r");
-    if (!f) return;
-    
-    char line[256];
-    unsigned long mem_total = 0, mem_free = 0, mem_available = 0;
-    unsigned long swap_total = 0, swap_free = 0;
-    
-    while (fgets(line, sizeof(line), f)) {
-        if (sscanf(line, "MemTotal: %lu kB", &mem_total) == 1) {}
-        if (sscanf(line, "MemAvailable: %lu kB", &mem_available) == 1) {}
-        if (sscanf(line, "MemFree: %lu kB", &mem_free) == 1) {}
-        if (sscanf(line, "SwapTotal: %lu kB", &swap_total) == 1) {}
-        if (sscanf(line, "SwapFree: %lu kB", &swap_free) == 1) {}
+/* Returns the next line of a buffer filled by src_read() and advances *pos,
+ * or NULL at the end of the buffer. The newline is overwritten. */
+char *src_next_line(char **pos) {
+    char *line = *pos;
+    if (!line || !*line) return NULL;
+    char *nl = strchr(line, '\n');
+    if (nl) {
+        *nl = '\0';
+        *pos = nl + 1;
+    } else {
+        *pos = line + strlen(line);
     }
-    fclose(f);
-    
-    if (mem_available == 0) mem_available = mem_free;
-    
-    double total_bytes = (double)mem_total * 1024;
-    double used_bytes = total_bytes - ((double)mem_available * 1024);
-    
-    double sw_total = (double)swap_total * 1024;
-    double sw_used = sw_total - ((double)swap_free * 1024);
-    
-    char bar[256], b1[32], b2[32];
-    
-    draw_bar_ascii(used_bytes, total_bytes, bar_width, bar, sizeof(bar));
-    format_bytes(used_bytes, b1, sizeof(b1));
-    format_bytes(total_bytes, b2, sizeof(b2));
-    printf("RAM:    %s %s%s/%s%s\n", bar, c_white(), b1, b2, c_reset());
-    
-    draw_bar_ascii(sw_used, sw_total, bar_width, bar, sizeof(bar));
-    format_bytes(sw_used, b1, sizeof(b1));
-    format_bytes(sw_total, b2, sizeof(b2));
-    printf("SWAP:   %s %s%s/%s%s\n", bar, c_white(), b1, b2, c_reset());
+    return line;
 }
 
-void get_disk_info(int bar_width) {
-    FILE *mtab = setmntent("/proc/mounts", "r");
-    if (!mtab) return;
-    
-    struct mntent *ent;
-    char bar[256], b1[32], b2[32];
-    
-    while ((ent = getmntent(mtab)) != NULL) {
-        if (strncmp(ent->mnt_fsname, "/dev/", 5) == 0 && strstr(ent->mnt_fsname, "loop") == NULL) {
-             struct statvfs s;
-             if (statvfs(ent->mnt_dir, &s) == 0) {
-                 unsigned long long total = s.f_blocks * s.f_frsize;
-                 unsigned long long free = s.f_bfree * s.f_frsize;
-                 unsigned long long used = total - free;
-                 
-                 draw_bar_ascii((double)used, (double)total, bar_width, bar, sizeof(bar));
-                 format_bytes((double)used, b1, sizeof(b1));
-                 format_bytes((double)total, b2, sizeof(b2));
-                 
-                 printf("%s%s%s (%s): %s %s%s/%s%s\n", 
-                    c_cyan(), ent->mnt_fsname, c_reset(), ent->mnt_dir,
-                    bar, c_white(), b1, b2, c_reset());
-             }
-        }
+/* Reads a small file that is not worth a cached fd into buf and
+ * NUL-terminates it; returns the length or -1. Goes through the capture
+ * like src_read(); a file that could not be read is not recorded. */
+ssize_t src_read_once(const char *path, char *buf, size_t size) {
+    if (replay_active) {
+        const unsigned char *data;
+        uint32_t len;
+        if (replay_find(path, &data, &len) != 0) return -1;
+        if (len > size - 1) len = size - 1;
+        memcpy(buf, data, len);
+        buf[len] = '\0';
+        return len;
     }
-    endmntent(mtab);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+    ssize_t n = read(fd, buf, size - 1);
+    close(fd);
+    if (n < 0) return -1;
+    buf[n] = '\0';
+    if (record_fd >= 0) record_bytes(path, buf, n);
+    return n;
 }
 
-/* Net state */
-#define MAX_IFACES 32
-net_stats_t net_prev[MAX_IFACES];
-int net_prev_count = 0;
-double last_net_time = 0;
+/* access(F_OK) through the capture: an existing path is recorded empty */
+int src_exists(const char *path) {
+    if (replay_active) {
+        const unsigned char *data;
+        uint32_t len;
+        return replay_find(path, &data, &len) == 0;
+    }
+    int exists = access(path, F_OK) == 0;
+    if (exists && record_fd >= 0) record_bytes(path, "", 0);
+    return exists;
+}
 
-double get_time_sec() {
-    struct timeval tv;
-    gettimeofday(&tv, NULL);
-    return tv.tv_sec + tv.tv_usec / 1e6;
+proc_src_t src_stat = { .fd = -1 };
+proc_src_t src_meminfo = { .fd = -1 };
+proc_src_t src_netdev = { .fd = -1 };
+proc_src_t src_diskstats = { .fd = -1 };
+
+#define MAX_DISKS 64
+#define MAX_DISKIO 64
+
+/* Interface state store
+ *
+ * Every interface ever seen gets a slot holding its last counters and
+ * cached link speed. Slot numbers are stable: the array only grows, and a
+ * slot is recycled through a free list only after its interface has been
+ * absent for a whole sample. Two open-addressing indexes map to slots, one
+ * keyed by ifindex and one by name hash; the name index serves the
+ * /proc/net/dev fallback (no ifindex) and detects a deleted interface
+ * re-created under the same name. Entries hold slot + 1, with 0 empty and
+ * -1 a tombstone; both indexes are rebuilt when they pass half load. */
+#define IFX_EMPTY 0
+#define IFX_TOMB -1
+
+typedef struct {
+    int live;
+    int ifindex;
+    char name[32];
+    unsigned long long rx, tx;  /* counters at the last sample */
+    double time;                /* when they were read; 0 = no baseline */
+    unsigned seen;              /* generation that last reported the interface */
+    int sample_idx;             /* position in the current sample_t, or -1 */
+    int next_free;
+    double speed_mbps;
+    int speed_stale;
+} iface_slot_t;
+
+typedef struct {
+    iface_slot_t *slots;
+    int count;                  /* slots handed out, live or free */
+    int cap;
+    int free_head;
+    int live;
+    int *by_index;
+    int *by_name;
+    size_t ix_cap;
+    size_t ix_used;             /* non-empty positions across both indexes */
+    unsigned gen;
+} iface_table_t;
+
+iface_table_t iftab = { .free_head = -1 };
+int link_events_ok = 0;
+
+uint32_t name_hash(const char *s) {
+    uint32_t h = 2166136261u;
+    while (*s) {
+        h ^= (unsigned char)*s++;
+        h *= 16777619u;
+    }
+    return h;
 }
 
-void get_net_info(int bar_width) {
-    FILE *f = fopen("/proc/net/dev", "r");
-    if (!f) return;
-    
-    double curr_time = get_time_sec();
-    double dt = curr_time - last_net_time;
-    
-    int first_run = (last_net_time == 0);
-    
-    char line[512];
-    fgets(line, sizeof(line), f);
-    fgets(line, sizeof(line), f);
-    
-    net_stats_t curr[MAX_IFACES];
-    int curr_count = 0;
-    
-    char bar[256], b1[32];
-    
-    int printed_wait_msg = 0;
-    
-    while (fgets(line, sizeof(line), f) && curr_count < MAX_IFACES) {
-        char *p = line;
-        while (*p == ' ') p++;
-        char *end = strchr(p, ':');
-        if (!end) continue;
-        *end = '\0';
-        strncpy(curr[curr_count].name, p, 31);
-        
-        p = end + 1;
-        unsigned long long r_bytes, r_packets, r_errs, r_drop, r_fifo, r_frame, r_compressed, r_multicast;
-        unsigned long long s_bytes, s_packets, s_errs, s_drop, s_fifo, s_colls, s_carrier, s_compressed;
-        
-        sscanf(p, "%llu %llu %llu %llu %llu %llu %llu %llu %llu %llu %llu %llu %llu %llu %llu %llu",
-            &r_bytes, &r_packets, &r_errs, &r_drop, &r_fifo, &r_frame, &r_compressed, &r_multicast,
-            &s_bytes, &s_packets, &s_errs, &s_drop, &s_fifo, &s_colls, &s_carrier, &s_compressed);
-            
-        curr[curr_count].bytes_recv = r_bytes;
-        curr[curr_count].bytes_sent = s_bytes;
-        
-        if (!first_run && dt > 0) {
-            for (int i = 0; i < net_prev_count; i++) {
-                if (strcmp(net_prev[i].name, curr[curr_count].name) == 0) {
-                    
-                    if (opt_net_iface && strcmp(opt_net_iface, curr[curr_count].name) != 0) break;
-                    
-                    double rx_spd = (curr[curr_count].bytes_recv - net_prev[i].bytes_recv) / dt;
-                    double tx_spd = (curr[curr_count].bytes_sent - net_prev[i].bytes_sent) / dt;
-                    
-                    double link_speed_mbps = 0;
-                    char path[256];
-                    snprintf(path, sizeof(path), "/sys/class/net/%s/speed", curr[curr_count].name);
-                    FILE *fs = fopen(path, "r");
-                    if (fs) {
-                        if (fscanf(fs, "%lf", &link_speed_mbps) != 1) link_speed_mbps = 0;
-                        fclose(fs);
-                    }
-                    
-                    double link_speed_bps = link_speed_mbps * 125000.0;
-                    
-                    if (link_speed_bps <= 0) link_speed_bps = 100 * 1024 * 1024;
-                    
-                    double rx_pct = 0, tx_pct = 0;
-                    if (link_speed_bps > 0) {
-                        rx_pct = (rx_spd / link_speed_bps) * 100.0;
-                        tx_pct = (tx_spd / link_speed_bps) * 100.0;
-                    }
-                    
-                    if (opt_net_iface == NULL || strcmp(opt_net_iface, curr[curr_count].name) == 0) {
-                        draw_bar_ascii(rx_pct, 100, bar_width, bar, sizeof(bar));
-                        format_bytes(rx_spd, b1, sizeof(b1));
-                        printf("DN:     %s %s%s/s%s\n", bar, c_white(), b1, c_reset());
-                        
-                        draw_bar_ascii(tx_pct, 100, bar_width, bar, sizeof(bar));
-                        format_bytes(tx_spd, b1, sizeof(b1));
-                        printf("UP:     %s %s%s/s%s\n", bar, c_white(), b1, c_reset());
-                    }
-                }
-            }
-        } else {
-            if (!printed_wait_msg) {
-                printf("%sNET%s:  Waiting for first sample...\n", c_magenta(), c_reset());
-                printed_wait_msg = 1;
-            }
-        }
-        
-        curr_count++;
+size_t ifindex_hash(int ifindex) {
+    return (size_t)((uint32_t)ifindex * 2654435761u);
+}
+
+/* Returns the index position whose slot matches the key, or -1. A NULL
+ * name keys on ifindex. */
+long iftab_probe(const iface_table_t *t, const int *ix, size_t h, int ifindex, const char *name) {
+    if (t->ix_cap == 0) return -1;
+    size_t mask = t->ix_cap - 1;
+    for (size_t i = h & mask, n = 0; n < t->ix_cap; i = (i + 1) & mask, n++) {
+        int v = ix[i];
+        if (v == IFX_EMPTY) return -1;
+        if (v == IFX_TOMB) continue;
+        const iface_slot_t *s = &t->slots[v - 1];
+        if (name ? strcmp(s->name, name) == 0 : s->ifindex == ifindex) return (long)i;
     }
-    fclose(f);
-    
-    memcpy(net_prev, curr, sizeof(curr));
-    net_prev_count = curr_count;
-    last_net_time = curr_time;
+    return -1;
 }
 
-/* Logging Functions */
-void write_log_header(int show_cpu, int show_mem, int show_disks, int show_net) {
-    if (!log_fp || log_header_written) return;
-    
-    fprintf(log_fp, "Timestamp");
-    
-    if (show_cpu) {
-        fprintf(log_fp, ",CPU_Total_Percent");
-        for (int i = 0; i < num_cores; i++) {
-            fprintf(log_fp, ",CPU_Core_%d_Percent", i);
+void iftab_ix_put(iface_table_t *t, int *ix, size_t h, int id) {
+    size_t mask = t->ix_cap - 1;
+    size_t i = h & mask;
+    while (ix[i] > 0) i = (i + 1) & mask;
+    if (ix[i] == IFX_EMPTY) t->ix_used++;
+    ix[i] = id + 1;
+}
+
+void iftab_ix_del(iface_table_t *t, int *ix, size_t h, int id) {
+    size_t mask = t->ix_cap - 1;
+    for (size_t i = h & mask, n = 0; n < t->ix_cap && ix[i] != IFX_EMPTY; i = (i + 1) & mask, n++) {
+        if (ix[i] == id + 1) {
+            ix[i] = IFX_TOMB;
+            return;
         }
     }
-    
-    if (show_mem) {
-        fprintf(log_fp, ",RAM_Used_Bytes,RAM_Total_Bytes,RAM_Percent,Swap_Used_Bytes,Swap_Total_Bytes,Swap_Percent");
+}
+
+int iftab_rebuild(iface_table_t *t, size_t cap) {
+    int *bi = calloc(cap, sizeof(int));
+    int *bn = calloc(cap, sizeof(int));
+    if (!bi || !bn) {
+        free(bi);
+        free(bn);
+        return -1;
     }
-    
-    if (show_disks) {
-        FILE *mtab = setmntent("/proc/mounts", "r");
-        if (mtab) {
-            struct mntent *ent;
-            while ((ent = getmntent(mtab)) != NULL) {
-                if (strncmp(ent->mnt_fsname, "/dev/", 5) == 0 && strstr(ent->mnt_fsname, "loop") == NULL) {
-                    fprintf(log_fp, ",Disk_%s_Used_Bytes,Disk_%s_Total_Bytes,Disk_%s_Percent", ent->mnt_fsname, ent->mnt_fsname, ent->mnt_fsname);
-                }
-            }
-            endmntent(mtab);
-        }
+    free(t->by_index);
+    free(t->by_name);
+    t->by_index = bi;
+    t->by_name = bn;
+    t->ix_cap = cap;
+    t->ix_used = 0;
+    for (int id = 0; id < t->count; id++) {
+        const iface_slot_t *s = &t->slots[id];
+        if (!s->live) continue;
+        if (s->ifindex > 0) iftab_ix_put(t, t->by_index, ifindex_hash(s->ifindex), id);
+        iftab_ix_put(t, t->by_name, name_hash(s->name), id);
     }
-    
-    if (show_net) {
-        FILE *f = fopen("/proc/net/dev", "r");
-        if (f) {
-            char line[512];
-            fgets(line, sizeof(line), f);
-            fgets(line, sizeof(line), f);
-            while (fgets(line, sizeof(line), f)) {
-                char *p = line;
-                while (*p == ' ') p++;
-                char *end = strchr(p, ':');
-                if (end) {
-                    *end = '\0';
-                    char *ifname = p;
-                    if (opt_net_iface == NULL || strcmp(opt_net_iface, ifname) == 0) {
-                        fprintf(log_fp, ",Net_%s_RX_Bps,Net_%s_TX_Bps", ifname, ifname);
-                    }
-                }
-            }
-            fclose(f);
-        }
+    return 0;
+}
+
+int iftab_link(iface_table_t *t, int id) {
+    if ((t->ix_used + 2) * 2 > t->ix_cap) {
+        size_t cap = t->ix_cap ? t->ix_cap : 64;
+        while ((size_t)(t->live + 1) * 4 > cap) cap *= 2;
+        /* the rebuild indexes every live slot, this one included */
+        return iftab_rebuild(t, cap);
     }
-    
-    fprintf(log_fp, "\n");
-    fflush(log_fp);
-    log_header_written = 1;
+    const iface_slot_t *s = &t->slots[id];
+    if (s->ifindex > 0) iftab_ix_put(t, t->by_index, ifindex_hash(s->ifindex), id);
+    iftab_ix_put(t, t->by_name, name_hash(s->name), id);
+    return 0;
 }
 
-void log_data(int show_cpu, int show_mem, int show_disks, int show_net) {
-    if (!log_fp) return;
-    
-    time_t t = time(NULL);
-    struct tm *tm = localtime(&t);
-    char timestamp[32];
-    strftime(timestamp, sizeof(timestamp), "%Y-%m-%d %H:%M:%S", tm);
-    fprintf(log_fp, "%s", timestamp);
-    
-    /* Log CPU */
-    if (show_cpu) {
-        cpu_stats_t curr_total;
-        cpu_stats_t *curr_cores = calloc(num_cores, sizeof(cpu_stats_t));
-        char line[512];
-        
-        FILE *f = fopen("/proc/stat", "r");
-        if (f) {
-            int core_idx = 0;
-            while (fgets(line, sizeof(line), f)) {
-                if (strncmp(line, "cpu ", 4) == 0) {
-                    parse_cpu_line(line, &curr_total);
-                } else if (strncmp(line, "cpu", 3) == 0 && isdigit(line[3])) {
-                    if (core_idx < num_cores) {
-                        parse_cpu_line(line, &curr_cores[core_idx]);
-                        core_idx++;
-                    }
-                }
-            }
-            fclose(f);
-            
-            double total_pct = calculate_cpu_percent(&curr_total, &cpu_prev_total);
-            fprintf(log_fp, ",%.2f", total_pct);
-            
-            for (int i = 0; i < num_cores; i++) {
-                double pct = calculate_cpu_percent(&curr_cores[i], &cpu_prev_cores[i]);
-                fprintf(log_fp, ",%.2f", pct);
+void iftab_unlink(iface_table_t *t, int id) {
+    const iface_slot_t *s = &t->slots[id];
+    if (s->ifindex > 0) iftab_ix_del(t, t->by_index, ifindex_hash(s->ifindex), id);
+    iftab_ix_del(t, t->by_name, name_hash(s->name), id);
+}
+
+/* Slot number for an interface, or -1. ifindex wins; the name is the fallback. */
+int iftab_lookup(const iface_table_t *t, int ifindex, const char *name) {
+    long p;
+    if (ifindex > 0) {
+        p = iftab_probe(t, t->by_index, ifindex_hash(ifindex), ifindex, NULL);
+        if (p >= 0) return t->by_index[p] - 1;
+    }
+    p = iftab_probe(t, t->by_name, name_hash(name), 0, name);
+    return p >= 0 ? t->by_name[p] - 1 : -1;
+}
+
+/* Finds or creates the slot for an interface. A name match with another
+ * ifindex is a new device and starts without a baseline; an ifindex match
+ * with another name is a rename and keeps it. Returns -1 on allocation failure. */
+int iftab_get(iface_table_t *t, int ifindex, const char *name) {
+    int id = iftab_lookup(t, ifindex, name);
+    if (id >= 0) {
+        iface_slot_t *s = &t->slots[id];
+        if (s->ifindex != ifindex || strcmp(s->name, name) != 0) {
+            iftab_unlink(t, id);
+            if (s->ifindex != ifindex) {
+                s->ifindex = ifindex;
+                s->time = 0;
+                s->speed_stale = 1;
             }
+            snprintf(s->name, sizeof(s->name), "%s", name);
+            iftab_link(t, id);
         }
-        free(curr_cores);
+        return id;
     }
     
-    /* Log Memory */
-    if (show_mem) {
-        FILE *f = fopen("/proc/meminfo", "r");
-        if (f) {
-            char line[256];
-            unsigned long mem_total = 0, mem_available = 0;
-            unsigned long swap_total = 0, swap_free = 0;
-            
-            while (fgets(line, sizeof(line), f)) {
-                if (sscanf(line, "MemTotal: %lu kB", &mem_total) == 1) {}
-                if (sscanf(line, "MemAvailable: %lu kB", &mem_available) == 1) {}
-                if (sscanf(line, "SwapTotal: %lu kB", &swap_total) == 1) {}
-                if (sscanf(line, "SwapFree: %lu kB", &swap_free) == 1) {}
+    if (t->free_head >= 0) {
+        id = t->free_head;
+        t->free_head = t->slots[id].next_free;
+    } else {
+        if (t->count == t->cap) {
+            int cap = t->cap ? t->cap * 2 : 32;
+            iface_slot_t *ns = realloc(t->slots, cap * sizeof(iface_slot_t));
+            if (!ns) return -1;
+            t->slots = ns;
+            t->cap = cap;
+        }
+        id = t->count++;
+    }
+    iface_slot_t *s = &t->slots[id];
+    memset(s, 0, sizeof(*s));
+    s->live = 1;
+    s->ifindex = ifindex;
+    snprintf(s->name, sizeof(s->name), "%s", name);
+    s->sample_idx = -1;
+    s->next_free = -1;
+    s->speed_stale = 1;
+    t->live++;
+    if (iftab_link(t, id) != 0) {
+        s->live = 0;
+        s->next_free = t->free_head;
+        t->free_head = id;
+        t->live--;
+        return -1;
+    }
+    return id;
+}
+
+/* Frees the slots of interfaces the current generation did not report */
+void iftab_sweep(iface_table_t *t) {
+    for (int id = 0; id < t->count; id++) {
+        iface_slot_t *s = &t->slots[id];
+        if (!s->live || s->seen == t->gen) continue;
+        iftab_unlink(t, id);
+        s->live = 0;
+        s->next_free = t->free_head;
+        t->free_head = id;
+        t->live--;
+    }
+}
+
+double read_speed_file(const char *ifname) {
+    char path[64], buf[32];
+    snprintf(path, sizeof(path), "/sys/class/net/%.31s/speed", ifname);
+    if (src_read_once(path, buf, sizeof(buf)) <= 0) return 0;
+    double mbps = atof(buf);
+    return mbps > 0 ? mbps : 0;
+}
+
+/* Link speed (Mb/s). The sysfs value only changes with the link state, so
+ * it is kept until a link-change notification marks it stale; without
+ * notifications it is re-read every tick. */
+double read_link_speed(iface_slot_t *s) {
+    if (s->speed_stale || !link_events_ok) {
+        s->speed_mbps = read_speed_file(s->name);
+        s->speed_stale = 0;
+    }
+    return s->speed_mbps;
+}
+
+/* ifindex 0 invalidates every cached speed */
+void link_speed_invalidate(int ifindex) {
+    if (ifindex == 0) {
+        for (int id = 0; id < iftab.count; id++) iftab.slots[id].speed_stale = 1;
+        return;
+    }
+    long p = iftab_probe(&iftab, iftab.by_index, ifindex_hash(ifindex), ifindex, NULL);
+    if (p >= 0) iftab.slots[iftab.by_index[p] - 1].speed_stale = 1;
+}
+
+/* Pressure Stall Information, one record per resource. avg10 is the
+ * kernel's percentage; total is cumulative stall time in microseconds. */
+enum { PSI_CPU, PSI_MEMORY, PSI_IO, PSI_COUNT };
+
+typedef struct {
+    double some_avg10, full_avg10;
+    unsigned long long some_total, full_total;
+    int ok;
+} psi_stats_t;
+
+/* Raw counters of one tick; the previous tick's copy is the delta baseline */
+typedef struct {
+    char fsname[64];
+    char dir[256];
+    unsigned long long used;
+    unsigned long long total;
+    int ok;
+    int stale;                  /* probe overdue; used/total are the last answer */
+} disk_stats_t;
+
+/* One /proc/diskstats line; ticks are milliseconds */
+typedef struct {
+    char name[32];
+    unsigned long long rd_ios, rd_sectors, rd_ticks;
+    unsigned long long wr_ios, wr_sectors, wr_ticks;
+    unsigned long long in_flight, io_ticks, time_in_queue;
+} diskio_stats_t;
+
+typedef struct {
+    cpu_stats_t total;
+    cpu_table_t cores;
+    unsigned long mem_total, mem_free, mem_available;
+    unsigned long swap_total, swap_free;
+    disk_stats_t disks[MAX_DISKS];
+    int disk_count;
+    net_stats_t *net;
+    int net_count;
+    int net_cap;
+    diskio_stats_t diskio[MAX_DISKIO];
+    int diskio_count;
+    double time;
+    double net_time;
+    double diskio_time;
+    psi_stats_t psi[PSI_COUNT];
+    double psi_time;
+} proc_snapshot_t;
+
+/* Core Monitoring Functions */
+
+/* Reference sscanf-based line parser, kept for comparison in bench/ */
+void parse_cpu_line(const char *line, cpu_stats_t *stats) {
+    sscanf(line, "%*s %llu %llu %llu %llu %llu %llu %llu %llu",
+           &stats->user, &stats->nice, &stats->system,
+           &stats->idle, &stats->iowait, &stats->irq,
+           &stats->softirq, &stats->steal);
+}
+
+int cpu_table_init(cpu_table_t *t, int cap) {
+    unsigned long long *block = calloc((size_t)cap * 8, sizeof(unsigned long long));
+    if (!block) return -1;
+    t->n = 0;
+    t->cap = cap;
+    t->user = block;
+    t->nice = block + cap;
+    t->system = block + 2 * cap;
+    t->idle = block + 3 * cap;
+    t->iowait = block + 4 * cap;
+    t->irq = block + 5 * cap;
+    t->softirq = block + 6 * cap;
+    t->steal = block + 7 * cap;
+    return 0;
+}
+
+/* Both tables come from cpu_table_init() with the same capacity */
+void cpu_table_copy(cpu_table_t *dst, const cpu_table_t *src) {
+    memcpy(dst->user, src->user, (size_t)src->cap * 8 * sizeof(unsigned long long));
+    dst->n = src->n;
+}
+
+void cpu_table_get(const cpu_table_t *t, int i, cpu_stats_t *out) {
+    out->user = t->user[i];
+    out->nice = t->nice[i];
+    out->system = t->system[i];
+    out->idle = t->idle[i];
+    out->iowait = t->iowait[i];
+    out->irq = t->irq[i];
+    out->softirq = t->softirq[i];
+    out->steal = t->steal[i];
+}
+
+/* Skips blanks and parses one unsigned decimal. Missing fields (older
+ * kernels print fewer columns) read as 0 without moving past the newline. */
+unsigned long long scan_u64(const char **p) {
+    const char *s = *p;
+    while (*s == ' ') s++;
+    unsigned long long v = 0;
+    while ((unsigned)(*s - '0') < 10) {
+        v = v * 10 + (unsigned)(*s - '0');
+        s++;
+    }
+    *p = s;
+    return v;
+}
+
+/* Single pass over the leading "cpu" lines of /proc/stat. Fills the
+ * aggregate line into total and per-core lines, in order, into the table.
+ * Returns the number of cores parsed. */
+int parse_proc_stat(const char *buf, cpu_stats_t *total, cpu_table_t *t) {
+    const char *p = buf;
+    int n = 0;
+    
+    while (p[0] == 'c' && p[1] == 'p' && p[2] == 'u') {
+        p += 3;
+        if (*p == ' ') {
+            total->user = scan_u64(&p);
+            total->nice = scan_u64(&p);
+            total->system = scan_u64(&p);
+            total->idle = scan_u64(&p);
+            total->iowait = scan_u64(&p);
+            total->irq = scan_u64(&p);
+            total->softirq = scan_u64(&p);
+            total->steal = scan_u64(&p);
+        } else if (n < t->cap) {
+            while ((unsigned)(*p - '0') < 10) p++;
+            t->user[n] = scan_u64(&p);
+            t->nice[n] = scan_u64(&p);
+            t->system[n] = scan_u64(&p);
+            t->idle[n] = scan_u64(&p);
+            t->iowait[n] = scan_u64(&p);
+            t->irq[n] = scan_u64(&p);
+            t->softirq[n] = scan_u64(&p);
+            t->steal[n] = scan_u64(&p);
+            n++;
+        }
+        p = strchr(p, '\n');
+        if (!p) break;
+        p++;
+    }
+    t->n = n;
+    return n;
+}
+
+double calculate_cpu_percent(cpu_stats_t *curr, cpu_stats_t *prev) {
+    unsigned long long prev_idle = prev->idle + prev->iowait;
+    unsigned long long curr_idle = curr->idle + curr->iowait;
+    
+    unsigned long long prev_non_idle = prev->user + prev->nice + prev->system + prev->irq + prev->softirq + prev->steal;
+    unsigned long long curr_non_idle = curr->user + curr->nice + curr->system + curr->irq + curr->softirq + curr->steal;
+    
+    unsigned long long prev_total = prev_idle + prev_non_idle;
+    unsigned long long curr_total = curr_idle + curr_non_idle;
+    
+    unsigned long long total_diff = curr_total - prev_total;
+    unsigned long long idle_diff = curr_idle - prev_idle;
+    
+    if (total_diff == 0) return 0.0;
+    
+    return ((double)(total_diff - idle_diff) / total_diff) * 100.0;
+}
+
+int num_cores = 0;
+
+proc_snapshot_t snapshots[2];
+proc_snapshot_t *snap = &snapshots[0];
+proc_snapshot_t *snap_prev = &snapshots[1];
+
+/* Tick Scheduler
+ * Ticks fire on absolute CLOCK_MONOTONIC deadlines from a periodic timerfd,
+ * so collection and rendering time does not stretch the period. Timer
+ * expirations that pass while a tick is still being processed are counted
+ * as missed instead of being run late. */
+int tick_fd = -1;
+int sched_base_ms = 0;
+long long tick_period_ns = 0;
+struct timespec tick_next;
+unsigned long long ticks_done = 0;
+unsigned long long ticks_missed = 0;
+
+/* Other fds can be waited on together with the tick through sched_watch().
+ * Their handler runs from sched_wait() and returns nonzero to end the wait
+ * early, so the main loop samples right away instead of at the next tick. */
+typedef int (*watch_fn)(int fd, uint32_t events);
+
+#define MAX_WATCHES 16
+#define WATCH_TICK 0xffffffffu
+
+int sched_epfd = -1;
+int watch_fds[MAX_WATCHES];
+watch_fn watch_fns[MAX_WATCHES];
+int watch_count = 0;
+
+/* Wall-clock timestamps are derived from the monotonic clock through an
+ * anchor taken at startup, so a clock step cannot skew rates or spacing. */
+double mono_anchor = 0;
+double wall_anchor = 0;
+
+double get_time_sec() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* When a collector read its source, under key ("clock:net") in a capture */
+double sample_clock(const char *key) {
+    if (replay_active) {
+        const unsigned char *data;
+        uint32_t len;
+        double t = replay_now;
+        if (replay_find(key, &data, &len) == 0 && len == sizeof(t)) memcpy(&t, data, sizeof(t));
+        return t;
+    }
+    double t = get_time_sec();
+    if (record_fd >= 0) record_bytes(key, &t, sizeof(t));
+    return t;
+}
+
+double mono_to_wall(double mono) {
+    return wall_anchor + (mono - mono_anchor);
+}
+
+/* Formats a wall time as "YYYY-mm-dd HH:MM:SS.mmm" */
+void format_timestamp(double wall, char *buf, size_t size) {
+    long long total_ms = llround(wall * 1000.0);
+    time_t secs = (time_t)(total_ms / 1000);
+    int ms = (int)(total_ms % 1000);
+    struct tm *tm = localtime(&secs);
+    size_t n = strftime(buf, size, "%Y-%m-%d %H:%M:%S", tm);
+    snprintf(buf + n, size - n, ".%03d", ms);
+}
+
+void timespec_add_ns(struct timespec *ts, long long ns) {
+    long long total = ts->tv_nsec + ns;
+    ts->tv_sec += total / 1000000000LL;
+    ts->tv_nsec = total % 1000000000LL;
+}
+
+int timespec_before(const struct timespec *a, const struct timespec *b) {
+    return a->tv_sec < b->tv_sec || (a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
+
+void sched_init(int interval_ms) {
+    struct timespec now, wall;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    clock_gettime(CLOCK_REALTIME, &wall);
+    mono_anchor = now.tv_sec + now.tv_nsec / 1e9;
+    wall_anchor = wall.tv_sec + wall.tv_nsec / 1e9;
+    
+    sched_base_ms = interval_ms;
+    tick_period_ns = (long long)interval_ms * 1000000LL;
+    tick_next = now;
+    timespec_add_ns(&tick_next, tick_period_ns);
+    
+    tick_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    if (tick_fd >= 0) {
+        struct itimerspec its;
+        its.it_value = tick_next;
+        its.it_interval.tv_sec = tick_period_ns / 1000000000LL;
+        its.it_interval.tv_nsec = tick_period_ns % 1000000000LL;
+        if (timerfd_settime(tick_fd, TFD_TIMER_ABSTIME, &its, NULL) != 0) {
+            close(tick_fd);
+            tick_fd = -1;
+        }
+    }
+}
+
+/* Changes the tick period; the next tick is one new period from now */
+void sched_set_period(long long period_ns) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    tick_period_ns = period_ns;
+    tick_next = now;
+    timespec_add_ns(&tick_next, tick_period_ns);
+    if (tick_fd >= 0) {
+        struct itimerspec its;
+        its.it_value = tick_next;
+        its.it_interval.tv_sec = tick_period_ns / 1000000000LL;
+        its.it_interval.tv_nsec = tick_period_ns % 1000000000LL;
+        timerfd_settime(tick_fd, TFD_TIMER_ABSTIME, &its, NULL);
+    }
+}
+
+/* Needs the timerfd: the clock_nanosleep fallback cannot wait on fds */
+int sched_watch(int fd, uint32_t events, watch_fn fn) {
+    if (tick_fd < 0 || watch_count >= MAX_WATCHES) return -1;
+    if (sched_epfd < 0) {
+        sched_epfd = epoll_create1(EPOLL_CLOEXEC);
+        if (sched_epfd < 0) return -1;
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.u32 = WATCH_TICK;
+        if (epoll_ctl(sched_epfd, EPOLL_CTL_ADD, tick_fd, &ev) != 0) {
+            close(sched_epfd);
+            sched_epfd = -1;
+            return -1;
+        }
+    }
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.u32 = watch_count;
+    if (epoll_ctl(sched_epfd, EPOLL_CTL_ADD, fd, &ev) != 0) return -1;
+    watch_fds[watch_count] = fd;
+    watch_fns[watch_count] = fn;
+    watch_count++;
+    return 0;
+}
+
+void sched_unwatch(int fd) {
+    if (sched_epfd >= 0) epoll_ctl(sched_epfd, EPOLL_CTL_DEL, fd, NULL);
+}
+
+/* Reads the timerfd expiration count; more than one means missed ticks */
+void sched_consume_tick(void) {
+    uint64_t expirations = 0;
+    for (;;) {
+        ssize_t n = read(tick_fd, &expirations, sizeof(expirations));
+        if (n == (ssize_t)sizeof(expirations)) break;
+        if (n < 0 && errno == EINTR && !stop_requested) continue;
+        expirations = 1;
+        break;
+    }
+    if (expirations > 1) ticks_missed += expirations - 1;
+    ticks_done++;
+}
+
+/* Blocks until the next tick deadline. Falls back to clock_nanosleep() with
+ * TIMER_ABSTIME when timerfd is unavailable. */
+void sched_wait(void) {
+    if (sched_epfd >= 0) {
+        struct epoll_event evs[MAX_WATCHES + 1];
+        for (;;) {
+            int n = epoll_wait(sched_epfd, evs, MAX_WATCHES + 1, -1);
+            if (n < 0) {
+                if (errno == EINTR && !stop_requested) continue;
+                return;
+            }
+            int wake = 0;
+            for (int i = 0; i < n; i++) {
+                uint32_t w = evs[i].data.u32;
+                if (w == WATCH_TICK) {
+                    sched_consume_tick();
+                    wake = 1;
+                } else if (w < (uint32_t)watch_count) {
+                    wake |= watch_fns[w](watch_fds[w], evs[i].events);
+                }
+            }
+            if (wake) return;
+        }
+    }
+    if (tick_fd >= 0) {
+        sched_consume_tick();
+        return;
+    }
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &tick_next, NULL) == EINTR && !stop_requested) {}
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    timespec_add_ns(&tick_next, tick_period_ns);
+    while (timespec_before(&tick_next, &now)) {
+        timespec_add_ns(&tick_next, tick_period_ns);
+        ticks_missed++;
+    }
+    ticks_done++;
+}
+
+void sample_cpu(proc_snapshot_t *s) {
+    if (src_read(&src_stat) != 0) return;
+    parse_proc_stat(src_stat.buf, &s->total, &s->cores);
+}
+
+void sample_memory(proc_snapshot_t *s) {
+    if (src_read(&src_meminfo) != 0) return;
+    char *pos = src_meminfo.buf, *line;
+    s->mem_total = s->mem_free = s->mem_available = 0;
+    s->swap_total = s->swap_free = 0;
+    while ((line = src_next_line(&pos)) != NULL) {
+        if (sscanf(line, "MemTotal: %lu kB", &s->mem_total) == 1) {}
+        if (sscanf(line, "MemAvailable: %lu kB", &s->mem_available) == 1) {}
+        if (sscanf(line, "MemFree: %lu kB", &s->mem_free) == 1) {}
+        if (sscanf(line, "SwapTotal: %lu kB", &s->swap_total) == 1) {}
+        if (sscanf(line, "SwapFree: %lu kB", &s->swap_free) == 1) {}
+    }
+    if (s->mem_available == 0) s->mem_available = s->mem_free;
+}
+
+/* Filesystem Capacity Probes
+ * statvfs() on a hung NFS or FUSE mount can block forever, so it never
+ * runs on the main thread. sample_disks() queues each mount for a pool of
+ * STATFS_WORKERS threads and waits at most STATFS_WAIT_MS for the answers;
+ * later ones are picked up on a following pass. Every mount keeps its last
+ * answer, and one whose probe has been outstanding for longer than
+ * opt_statfs_timeout ms is reported stale with that answer. A mount is
+ * never queued twice, so a hung mount ties up at most one worker. */
+#define STATFS_WORKERS 4
+#define STATFS_SLOTS (MAX_DISKS * 2)
+#define STATFS_WAIT_MS 20
+
+enum { STATFS_IDLE, STATFS_QUEUED, STATFS_RUNNING };
+
+typedef struct {
+    char dir[256];              /* empty = free slot */
+    int state;
+    unsigned gen;               /* last mount table pass that listed it */
+    double queued;              /* when the outstanding probe was queued */
+    int answered;
+    int ok;
+    unsigned long long used, total;
+} statfs_slot_t;
+
+statfs_slot_t statfs_slots[STATFS_SLOTS];
+int statfs_queue[STATFS_SLOTS];
+int statfs_qhead = 0;
+int statfs_qlen = 0;
+unsigned statfs_gen = 0;
+int statfs_started = 0;
+int statfs_workers = 0;
+int opt_statfs_timeout = 1000;
+pthread_mutex_t statfs_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t statfs_work = PTHREAD_COND_INITIALIZER;
+pthread_cond_t statfs_done;
+
+void *statfs_main(void *arg) {
+    (void)arg;
+    char dir[256];
+    pthread_mutex_lock(&statfs_lock);
+    for (;;) {
+        while (statfs_qlen == 0) pthread_cond_wait(&statfs_work, &statfs_lock);
+        statfs_slot_t *slot = &statfs_slots[statfs_queue[statfs_qhead]];
+        statfs_qhead = (statfs_qhead + 1) % STATFS_SLOTS;
+        statfs_qlen--;
+        slot->state = STATFS_RUNNING;
+        memcpy(dir, slot->dir, sizeof(dir));
+        pthread_mutex_unlock(&statfs_lock);
+        
+        struct statvfs st;
+        int ok = (statvfs(dir, &st) == 0);
+        
+        pthread_mutex_lock(&statfs_lock);
+        slot->ok = ok;
+        slot->total = ok ? st.f_blocks * st.f_frsize : 0;
+        slot->used = ok ? slot->total - st.f_bfree * st.f_frsize : 0;
+        slot->answered = 1;
+        slot->state = STATFS_IDLE;
+        /* Unmounted while the probe ran: nothing will look the slot up */
+        if (slot->gen != statfs_gen) slot->dir[0] = '\0';
+        pthread_cond_broadcast(&statfs_done);
+    }
+    return NULL;
+}
+
+/* Workers are detached: one stuck in a hung mount cannot be joined */
+void statfs_init(void) {
+    statfs_started = 1;
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&statfs_done, &attr);
+    pthread_condattr_destroy(&attr);
+    
+    for (int i = 0; i < STATFS_WORKERS; i++) {
+        pthread_t t;
+        if (pthread_create(&t, NULL, statfs_main, NULL) != 0) break;
+        pthread_detach(t);
+        statfs_workers++;
+    }
+}
+
+/* Finds or claims the slot of a mount point; needs statfs_lock */
+int statfs_slot(const char *dir) {
+    int free_slot = -1;
+    for (int i = 0; i < STATFS_SLOTS; i++) {
+        if (statfs_slots[i].dir[0] == '\0') {
+            if (free_slot < 0) free_slot = i;
+        } else if (strcmp(statfs_slots[i].dir, dir) == 0) {
+            statfs_slots[i].gen = statfs_gen;
+            return i;
+        }
+    }
+    if (free_slot < 0) return -1;
+    statfs_slot_t *slot = &statfs_slots[free_slot];
+    memset(slot, 0, sizeof(*slot));
+    snprintf(slot->dir, sizeof(slot->dir), "%s", dir);
+    slot->gen = statfs_gen;
+    return free_slot;
+}
+
+/* Mount Table
+ * The /dev mounts are parsed once from /proc/self/mounts and kept, along
+ * with their statfs slot, until the kernel flags a change: the file then
+ * polls POLLPRI. The fd sits on the scheduler's epoll when it can, else
+ * it is polled without blocking on every pass. Container hosts can carry
+ * thousands of bind and overlay mounts, and none of them are walked on
+ * ticks where nothing was mounted or unmounted. */
+typedef struct {
+    char fsname[64];
+    char dir[256];
+    int slot;
+} mount_ent_t;
+
+mount_ent_t mounts[MAX_DISKS];
+int mount_count = 0;
+int mounts_dirty = 1;
+int mounts_watched = 0;
+unsigned long long mounts_reloads = 0;
+proc_src_t src_mounts;
+
+int mounts_changed(int fd, uint32_t events) {
+    (void)fd;
+    (void)events;
+    mounts_dirty = 1;
+    return 0;
+}
+
+/* Needs the scheduler for the epoll watch */
+void mounts_init(void) {
+    src_open(&src_mounts, "/proc/self/mounts", 1);
+    if (!replay_active && src_mounts.fd >= 0 && sched_watch(src_mounts.fd, EPOLLPRI, mounts_changed) == 0) {
+        mounts_watched = 1;
+    }
+}
+
+/* Copies one space-separated field, decoding the kernel's octal escapes */
+char *mount_field(char *p, char *out, size_t size) {
+    size_t n = 0;
+    while (*p == ' ') p++;
+    while (*p && *p != ' ') {
+        char c = *p++;
+        if (c == '\\' && p[0] >= '0' && p[0] <= '7' && p[1] >= '0' && p[1] <= '7' && p[2] >= '0' && p[2] <= '7') {
+            c = (char)((p[0] - '0') * 64 + (p[1] - '0') * 8 + (p[2] - '0'));
+            p += 3;
+        }
+        if (n + 1 < size) out[n++] = c;
+    }
+    out[n] = '\0';
+    return p;
+}
+
+/* Rebuilds the list and releases slots of vanished mounts; needs statfs_lock */
+void mounts_reload(void) {
+    mounts_dirty = 0;
+    mounts_reloads++;
+    mount_count = 0;
+    statfs_gen++;
+    if (src_read(&src_mounts) != 0) return;
+    
+    char *pos = src_mounts.buf, *line;
+    while ((line = src_next_line(&pos)) != NULL && mount_count < MAX_DISKS) {
+        if (strncmp(line, "/dev/", 5) != 0) continue;
+        mount_ent_t *m = &mounts[mount_count];
+        line = mount_field(line, m->fsname, sizeof(m->fsname));
+        mount_field(line, m->dir, sizeof(m->dir));
+        if (strstr(m->fsname, "loop") != NULL) continue;
+        m->slot = statfs_slot(m->dir);
+        mount_count++;
+    }
+    for (int i = 0; i < STATFS_SLOTS; i++) {
+        statfs_slot_t *slot = &statfs_slots[i];
+        if (slot->dir[0] && slot->gen != statfs_gen && slot->state == STATFS_IDLE) slot->dir[0] = '\0';
+    }
+}
+
+/* The verdict each mount got depends on the workers' timing, so a
+ * capture keeps it rather than the statvfs() call */
+void statfs_capture(disk_stats_t *d) {
+    char key[300], buf[96];
+    snprintf(key, sizeof(key), "statvfs:%s", d->dir);
+    if (replay_active) {
+        int ok = 0, stale = 0;
+        unsigned long long total = 0, used = 0;
+        if (src_read_once(key, buf, sizeof(buf)) > 0) sscanf(buf, "%d %d %llu %llu", &ok, &stale, &total, &used);
+        d->ok = ok;
+        d->stale = stale;
+        d->total = total;
+        d->used = used;
+    } else if (record_fd >= 0) {
+        int n = snprintf(buf, sizeof(buf), "%d %d %llu %llu", d->ok, d->stale, d->total, d->used);
+        record_bytes(key, buf, n);
+    }
+}
+
+void sample_disks(proc_snapshot_t *s) {
+    if (!statfs_started) statfs_init();
+    char waiting[MAX_DISKS];
+    double now = get_time_sec();
+    pthread_mutex_lock(&statfs_lock);
+    if (!mounts_watched && !replay_active && src_mounts.fd >= 0) {
+        struct pollfd pfd = { .fd = src_mounts.fd, .events = POLLPRI };
+        if (poll(&pfd, 1, 0) > 0 && (pfd.revents & POLLPRI)) mounts_dirty = 1;
+    }
+    /* A capture re-reads the table on the tick the change was seen */
+    if (replay_active && src_mounts.path) {
+        const unsigned char *data;
+        uint32_t len;
+        if (replay_find(src_mounts.path, &data, &len) == 0) mounts_dirty = 1;
+    }
+    if (mounts_dirty) mounts_reload();
+    
+    s->disk_count = mount_count;
+    for (int i = 0; i < mount_count; i++) {
+        disk_stats_t *d = &s->disks[i];
+        memcpy(d->fsname, mounts[i].fsname, sizeof(d->fsname));
+        memcpy(d->dir, mounts[i].dir, sizeof(d->dir));
+        int id = mounts[i].slot;
+        waiting[i] = 0;
+        if (id < 0 || replay_active || statfs_slots[id].state != STATFS_IDLE || statfs_workers == 0) continue;
+        waiting[i] = 1;
+        statfs_slots[id].state = STATFS_QUEUED;
+        statfs_slots[id].queued = now;
+        statfs_queue[(statfs_qhead + statfs_qlen++) % STATFS_SLOTS] = id;
+    }
+    if (statfs_qlen > 0) pthread_cond_broadcast(&statfs_work);
+    
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    timespec_add_ns(&deadline, STATFS_WAIT_MS * 1000000LL);
+    for (;;) {
+        int pending = 0;
+        for (int i = 0; i < mount_count; i++) {
+            if (waiting[i] && statfs_slots[mounts[i].slot].state != STATFS_IDLE) pending = 1;
+        }
+        if (!pending || pthread_cond_timedwait(&statfs_done, &statfs_lock, &deadline) == ETIMEDOUT) break;
+    }
+    
+    now = get_time_sec();
+    for (int i = 0; i < mount_count; i++) {
+        disk_stats_t *d = &s->disks[i];
+        int id = mounts[i].slot;
+        const statfs_slot_t *slot = id >= 0 ? &statfs_slots[id] : NULL;
+        d->ok = slot && slot->answered && slot->ok;
+        d->total = d->ok ? slot->total : 0;
+        d->used = d->ok ? slot->used : 0;
+        d->stale = !slot || statfs_workers == 0 ||
+                   (slot->state != STATFS_IDLE && (now - slot->queued) * 1000.0 > opt_statfs_timeout);
+        statfs_capture(d);
+    }
+    pthread_mutex_unlock(&statfs_lock);
+}
+
+/* Interface tables grow with the host; the arrays are reused across ticks */
+net_stats_t *net_append(proc_snapshot_t *s) {
+    if (s->net_count == s->net_cap) {
+        int cap = s->net_cap ? s->net_cap * 2 : 32;
+        net_stats_t *nn = realloc(s->net, cap * sizeof(net_stats_t));
+        if (!nn) return NULL;
+        s->net = nn;
+        s->net_cap = cap;
+    }
+    return &s->net[s->net_count++];
+}
+
+/* Fallback when rtnetlink is unavailable */
+void sample_net_procfs(proc_snapshot_t *s) {
+    if (src_read(&src_netdev) != 0) return;
+    s->net_time = sample_clock("clock:net");
+    
+    char *pos = src_netdev.buf, *line;
+    src_next_line(&pos);
+    src_next_line(&pos);
+    
+    while ((line = src_next_line(&pos)) != NULL) {
+        char *p = line;
+        while (*p == ' ') p++;
+        char *end = strchr(p, ':');
+        if (!end) continue;
+        *end = '\0';
+        net_stats_t *n = net_append(s);
+        if (!n) break;
+        snprintf(n->name, sizeof(n->name), "%s", p);
+        n->ifindex = 0;
+        
+        unsigned long long r_bytes = 0, s_bytes = 0;
+        sscanf(end + 1, "%llu %*s %*s %*s %*s %*s %*s %*s %llu", &r_bytes, &s_bytes);
+        n->bytes_recv = r_bytes;
+        n->bytes_sent = s_bytes;
+    }
+}
+
+/* rtnetlink collector: one RTM_GETLINK dump returns IFLA_STATS64 for every
+ * interface. A second socket joined to RTMGRP_LINK carries link-change
+ * notifications, which are the only time cached link speeds are re-read. */
+int nl_fd = -1;
+int nl_event_fd = -1;
+unsigned nl_seq = 0;
+uint32_t nl_buf[16384];
+
+void nl_open(void) {
+    nl_fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+    if (nl_fd < 0) return;
+    
+    nl_event_fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC | SOCK_NONBLOCK, NETLINK_ROUTE);
+    if (nl_event_fd >= 0) {
+        struct sockaddr_nl sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.nl_family = AF_NETLINK;
+        sa.nl_groups = RTMGRP_LINK;
+        if (bind(nl_event_fd, (struct sockaddr *)&sa, sizeof(sa)) != 0) {
+            close(nl_event_fd);
+            nl_event_fd = -1;
+        }
+    }
+    link_events_ok = (nl_event_fd >= 0);
+}
+
+void nl_drain_events(void) {
+    if (nl_event_fd < 0) return;
+    for (;;) {
+        ssize_t n = recv(nl_event_fd, nl_buf, sizeof(nl_buf), MSG_DONTWAIT);
+        if (n < 0) {
+            /* Overrun: notifications were lost, so trust nothing cached */
+            if (errno == ENOBUFS) {
+                link_speed_invalidate(0);
+                continue;
+            }
+            break;
+        }
+        int len = (int)n;
+        for (struct nlmsghdr *nh = (struct nlmsghdr *)nl_buf; NLMSG_OK(nh, len); nh = NLMSG_NEXT(nh, len)) {
+            if (nh->nlmsg_type == RTM_NEWLINK || nh->nlmsg_type == RTM_DELLINK) {
+                struct ifinfomsg *ifm = NLMSG_DATA(nh);
+                link_speed_invalidate(ifm->ifi_index);
+            }
+        }
+    }
+}
+
+void nl_parse_link(proc_snapshot_t *s, struct nlmsghdr *nh) {
+    struct ifinfomsg *ifm = NLMSG_DATA(nh);
+    const char *name = NULL;
+    struct rtnl_link_stats64 st64;
+    struct rtnl_link_stats st32;
+    int have64 = 0, have32 = 0;
+    
+    int len = IFLA_PAYLOAD(nh);
+    for (struct rtattr *rta = IFLA_RTA(ifm); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+        if (rta->rta_type == IFLA_IFNAME) {
+            name = RTA_DATA(rta);
+        } else if (rta->rta_type == IFLA_STATS64 && RTA_PAYLOAD(rta) >= sizeof(st64)) {
+            /* Attribute payloads are only 4-byte aligned */
+            memcpy(&st64, RTA_DATA(rta), sizeof(st64));
+            have64 = 1;
+        } else if (rta->rta_type == IFLA_STATS && RTA_PAYLOAD(rta) >= sizeof(st32)) {
+            memcpy(&st32, RTA_DATA(rta), sizeof(st32));
+            have32 = 1;
+        }
+    }
+    if (!name || (!have64 && !have32)) return;
+    
+    net_stats_t *n = net_append(s);
+    if (!n) return;
+    snprintf(n->name, sizeof(n->name), "%s", name);
+    n->ifindex = ifm->ifi_index;
+    n->bytes_recv = have64 ? st64.rx_bytes : st32.rx_bytes;
+    n->bytes_sent = have64 ? st64.tx_bytes : st32.tx_bytes;
+}
+
+int sample_net_netlink(proc_snapshot_t *s) {
+    struct {
+        struct nlmsghdr nh;
+        struct ifinfomsg ifm;
+    } req;
+    memset(&req, 0, sizeof(req));
+    req.nh.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg));
+    req.nh.nlmsg_type = RTM_GETLINK;
+    req.nh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+    req.nh.nlmsg_seq = ++nl_seq;
+    req.ifm.ifi_family = AF_UNSPEC;
+    if (send(nl_fd, &req, req.nh.nlmsg_len, 0) < 0) return -1;
+    s->net_time = get_time_sec();
+    
+    for (;;) {
+        ssize_t n = recv(nl_fd, nl_buf, sizeof(nl_buf), MSG_TRUNC);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0 || (size_t)n > sizeof(nl_buf)) return -1;
+        int len = (int)n;
+        for (struct nlmsghdr *nh = (struct nlmsghdr *)nl_buf; NLMSG_OK(nh, len); nh = NLMSG_NEXT(nh, len)) {
+            if (nh->nlmsg_seq != nl_seq) continue;
+            if (nh->nlmsg_type == NLMSG_DONE) return 0;
+            if (nh->nlmsg_type == NLMSG_ERROR) return -1;
+            if (nh->nlmsg_type == RTM_NEWLINK) nl_parse_link(s, nh);
+        }
+    }
+}
+
+void sample_net(proc_snapshot_t *s) {
+    s->net_count = 0;
+    if (nl_fd >= 0) {
+        nl_drain_events();
+        if (sample_net_netlink(s) == 0) return;
+        s->net_count = 0;
+    }
+    sample_net_procfs(s);
+}
+
+/* Whole block devices are those listed in /sys/block; partitions, loop and
+ * ram devices are skipped. The verdict is cached per name so the check
+ * costs one access() the first time a device is seen. */
+typedef struct {
+    char name[32];
+    int whole;
+} diskio_kind_t;
+
+diskio_kind_t diskio_kinds[MAX_DISKIO * 4];
+int diskio_kind_count = 0;
+
+int diskio_is_whole(const char *name) {
+    for (int i = 0; i < diskio_kind_count; i++) {
+        if (strcmp(diskio_kinds[i].name, name) == 0) return diskio_kinds[i].whole;
+    }
+    char path[64];
+    snprintf(path, sizeof(path), "/sys/block/%.31s", name);
+    int whole = strncmp(name, "loop", 4) != 0 && strncmp(name, "ram", 3) != 0 &&
+                src_exists(path);
+    if (diskio_kind_count < (int)(sizeof(diskio_kinds) / sizeof(diskio_kinds[0]))) {
+        diskio_kind_t *k = &diskio_kinds[diskio_kind_count++];
+        snprintf(k->name, sizeof(k->name), "%s", name);
+        k->whole = whole;
+    }
+    return whole;
+}
+
+void sample_diskio(proc_snapshot_t *s) {
+    s->diskio_count = 0;
+    if (src_read(&src_diskstats) != 0) return;
+    s->diskio_time = sample_clock("clock:diskio");
+    
+    char *pos = src_diskstats.buf, *line;
+    while ((line = src_next_line(&pos)) != NULL && s->diskio_count < MAX_DISKIO) {
+        const char *p = line;
+        scan_u64(&p);
+        scan_u64(&p);
+        while (*p == ' ') p++;
+        const char *name = p;
+        while (*p && *p != ' ') p++;
+        size_t len = p - name;
+        if (len == 0 || len >= sizeof(s->diskio[0].name)) continue;
+        
+        diskio_stats_t *d = &s->diskio[s->diskio_count];
+        memcpy(d->name, name, len);
+        d->name[len] = '\0';
+        if (!diskio_is_whole(d->name)) continue;
+        
+        d->rd_ios = scan_u64(&p);
+        scan_u64(&p);
+        d->rd_sectors = scan_u64(&p);
+        d->rd_ticks = scan_u64(&p);
+        d->wr_ios = scan_u64(&p);
+        scan_u64(&p);
+        d->wr_sectors = scan_u64(&p);
+        d->wr_ticks = scan_u64(&p);
+        d->in_flight = scan_u64(&p);
+        d->io_ticks = scan_u64(&p);
+        d->time_in_queue = scan_u64(&p);
+        s->diskio_count++;
+    }
+}
+
+/* Cached File Descriptors
+ *
+ * The process and cgroup scanners keep per-object fds open between ticks
+ * and re-read them with pread at offset 0. They share one budget: the
+ * RLIMIT_NOFILE soft limit, raised to the hard limit, minus a reserve for
+ * everything else. Past the budget a file is opened for each read. */
+#define FD_CACHE_RESERVE 256
+
+long fd_cache_budget = -1;
+long fd_cache_open = 0;
+
+void fd_cache_init(void) {
+    if (fd_cache_budget >= 0) return;
+    fd_cache_budget = 0;
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) != 0) return;
+    if (rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+        getrlimit(RLIMIT_NOFILE, &rl);
+    }
+    if (rl.rlim_cur == RLIM_INFINITY) fd_cache_budget = 1L << 20;
+    else if (rl.rlim_cur > FD_CACHE_RESERVE) fd_cache_budget = (long)rl.rlim_cur - FD_CACHE_RESERVE;
+}
+
+/* Reads path (relative to dirfd) through *fd, opening it on first use and
+ * keeping it while the budget allows. Returns bytes read, or -1 if the
+ * file cannot be opened or read (the object is gone). */
+ssize_t read_cached_at(int dirfd, const char *path, int *fd, char *buf, size_t size) {
+    if (*fd < 0) {
+        int nfd = openat(dirfd, path, O_RDONLY | O_CLOEXEC);
+        if (nfd < 0) return -1;
+        ssize_t n = pread(nfd, buf, size - 1, 0);
+        if (n >= 0 && fd_cache_open < fd_cache_budget) {
+            *fd = nfd;
+            fd_cache_open++;
+        } else {
+            close(nfd);
+        }
+        if (n >= 0) buf[n] = '\0';
+        return n;
+    }
+    ssize_t n = pread(*fd, buf, size - 1, 0);
+    if (n >= 0) buf[n] = '\0';
+    return n;
+}
+
+void fd_cache_close(int *fd) {
+    if (*fd >= 0) {
+        close(*fd);
+        fd_cache_open--;
+    }
+    *fd = -1;
+}
+
+/* Process Scanner
+ *
+ * Per-PID state lives in an open-addressing hash table (linear probing,
+ * backward-shift deletion) keyed by PID. Reading every /proc/[pid]/stat
+ * each tick does not scale to tens of thousands of processes, so the work
+ * is bounded per tick:
+ *   - /proc is listed incrementally, one getdents64 chunk per tick, from a
+ *     persistent directory fd; a PID not seen for a whole pass is evicted.
+ *     New processes therefore show up within one pass (about a thousand
+ *     PIDs per tick); startup does a single full pass to set baselines.
+ *   - stat and io fds are cached per PID within the shared fd budget.
+ *   - Entries that were active on their last read, new entries and the
+ *     current top N are re-read every tick; idle entries are refreshed
+ *     round-robin with what is left of PROCS_READ_BUDGET_MS. Both passes
+ *     resume where the previous tick stopped, so nothing starves.
+ * Rates are computed over each entry's own interval between reads, so a
+ * process refreshed less often still reports a correct average. */
+#define PROCS_READ_BUDGET_MS 3.0
+
+enum { PROCS_SORT_CPU, PROCS_SORT_RSS, PROCS_SORT_IO };
+
+typedef struct {
+    int pid;                    /* 0 marks an empty slot */
+    int stat_fd, io_fd;
+    unsigned pass;              /* directory pass that last listed the PID */
+    unsigned read_tick;
+    unsigned top_tick;
+    unsigned char fresh, hot, dead, io_denied, has_rates;
+    char comm[16];
+    unsigned long long start_time;
+    unsigned long long cpu_ticks;
+    unsigned long long io_bytes;
+    double rss_bytes;
+    double read_time;
+    double cpu_pct;
+    double io_bps;
+} proc_entry_t;
+
+typedef struct {
+    proc_entry_t *slots;
+    size_t cap;
+    size_t count;
+} proc_table_t;
+
+int opt_procs = 0;
+int opt_procs_sort = PROCS_SORT_CPU;
+
+proc_table_t procs;
+int procs_dirfd = -1;
+unsigned procs_pass = 1;
+unsigned procs_tick = 0;
+size_t procs_cursor = 0;
+size_t procs_hot_cursor = 0;
+double procs_clk_tck = 100;
+double procs_page_size = 4096;
+double procs_scan_ms = 0;
+int procs_top[256];
+int procs_top_count = 0;
+int procs_dead = 0;
+char procs_dents[32768];
+
+struct linux_dirent64 {
+    unsigned long long d_ino;
+    long long d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+size_t ptab_hash(int pid) {
+    return (size_t)((uint32_t)pid * 2654435761u);
+}
+
+int ptab_init(proc_table_t *t, size_t cap) {
+    t->slots = calloc(cap, sizeof(proc_entry_t));
+    if (!t->slots) return -1;
+    t->cap = cap;
+    t->count = 0;
+    return 0;
+}
+
+proc_entry_t *ptab_find(proc_table_t *t, int pid) {
+    size_t mask = t->cap - 1;
+    for (size_t i = ptab_hash(pid) & mask; t->slots[i].pid != 0; i = (i + 1) & mask) {
+        if (t->slots[i].pid == pid) return &t->slots[i];
+    }
+    return NULL;
+}
+
+/* Doubles the table at half load; entries (and their cached fds) move by value */
+int ptab_grow(proc_table_t *t) {
+    proc_table_t nt;
+    if (ptab_init(&nt, t->cap * 2) != 0) return -1;
+    size_t mask = nt.cap - 1;
+    for (size_t i = 0; i < t->cap; i++) {
+        if (t->slots[i].pid == 0) continue;
+        size_t j = ptab_hash(t->slots[i].pid) & mask;
+        while (nt.slots[j].pid != 0) j = (j + 1) & mask;
+        nt.slots[j] = t->slots[i];
+    }
+    nt.count = t->count;
+    free(t->slots);
+    *t = nt;
+    procs_cursor = procs_hot_cursor = 0;
+    return 0;
+}
+
+proc_entry_t *ptab_insert(proc_table_t *t, int pid) {
+    if ((t->count + 1) * 2 > t->cap && ptab_grow(t) != 0) return NULL;
+    size_t mask = t->cap - 1;
+    size_t i = ptab_hash(pid) & mask;
+    while (t->slots[i].pid != 0) {
+        if (t->slots[i].pid == pid) return &t->slots[i];
+        i = (i + 1) & mask;
+    }
+    proc_entry_t *e = &t->slots[i];
+    memset(e, 0, sizeof(*e));
+    e->pid = pid;
+    e->stat_fd = e->io_fd = -1;
+    e->fresh = 1;
+    t->count++;
+    return e;
+}
+
+void proc_entry_close(proc_entry_t *e) {
+    fd_cache_close(&e->stat_fd);
+    fd_cache_close(&e->io_fd);
+}
+
+/* Empties slot i and shifts the rest of its probe run back over it */
+void ptab_remove(proc_table_t *t, size_t i) {
+    size_t mask = t->cap - 1;
+    proc_entry_close(&t->slots[i]);
+    for (size_t j = (i + 1) & mask; t->slots[j].pid != 0; j = (j + 1) & mask) {
+        size_t home = ptab_hash(t->slots[j].pid) & mask;
+        /* j may fill the hole unless its home lies cyclically in (i, j] */
+        int stays = (i <= j) ? (home > i && home <= j) : (home > i || home <= j);
+        if (!stays) {
+            t->slots[i] = t->slots[j];
+            i = j;
+        }
+    }
+    t->slots[i].pid = 0;
+    t->count--;
+}
+
+/* Reads /proc/<pid>/<name>. Returns bytes read, or -1 if the file is gone. */
+ssize_t proc_read_file(int pid, const char *name, int *fd, char *buf, size_t size) {
+    char path[32];
+    if (*fd < 0) snprintf(path, sizeof(path), "%d/%s", pid, name);
+    return read_cached_at(procs_dirfd, path, fd, buf, size);
+}
+
+/* Skips n blank-separated fields, including signed ones scan_u64 stops at */
+void skip_fields(const char **p, int n) {
+    const char *s = *p;
+    while (n-- > 0) {
+        while (*s == ' ') s++;
+        while (*s && *s != ' ') s++;
+    }
+    *p = s;
+}
+
+void proc_refresh(proc_entry_t *e, double now) {
+    char buf[1024];
+    e->read_tick = procs_tick;
+    e->fresh = 0;
+    if (proc_read_file(e->pid, "stat", &e->stat_fd, buf, sizeof(buf)) <= 0) {
+        e->dead = 1;
+        procs_dead++;
+        return;
+    }
+    
+    /* "pid (comm) state ppid ..." where comm may itself hold spaces or ')' */
+    char *open_paren = strchr(buf, '(');
+    char *close_paren = strrchr(buf, ')');
+    if (!open_paren || !close_paren || close_paren < open_paren) return;
+    size_t clen = close_paren - open_paren - 1;
+    if (clen >= sizeof(e->comm)) clen = sizeof(e->comm) - 1;
+    memcpy(e->comm, open_paren + 1, clen);
+    e->comm[clen] = '\0';
+    
+    const char *p = close_paren + 1;
+    skip_fields(&p, 11);                    /* state .. cmajflt */
+    unsigned long long utime = scan_u64(&p);
+    unsigned long long stime = scan_u64(&p);
+    skip_fields(&p, 6);                     /* cutime .. itrealvalue */
+    unsigned long long start = scan_u64(&p);
+    skip_fields(&p, 1);                     /* vsize */
+    unsigned long long rss = scan_u64(&p);
+    unsigned long long cpu = utime + stime;
+    
+    unsigned long long io = e->io_bytes;
+    if (!e->io_denied) {
+        if (proc_read_file(e->pid, "io", &e->io_fd, buf, sizeof(buf)) > 0) {
+            const char *r = strstr(buf, "read_bytes:");
+            const char *w = strstr(buf, "write_bytes:");
+            io = 0;
+            if (r) { r += 11; io += scan_u64(&r); }
+            if (w) { w += 12; io += scan_u64(&w); }
+        } else {
+            e->io_denied = 1;
+            io = 0;
+        }
+    }
+    
+    /* A different start time means the PID was reused: drop the baseline */
+    if (e->read_time > 0 && start != e->start_time) {
+        e->has_rates = 0;
+        e->read_time = 0;
+    }
+    
+    double dt = now - e->read_time;
+    if (e->read_time > 0 && dt > 0) {
+        e->cpu_pct = (cpu - e->cpu_ticks) / procs_clk_tck / dt * 100.0;
+        e->io_bps = io >= e->io_bytes ? (io - e->io_bytes) / dt : 0;
+        e->hot = (cpu != e->cpu_ticks || io != e->io_bytes);
+        e->has_rates = 1;
+    } else {
+        e->hot = 1;
+    }
+    e->start_time = start;
+    e->cpu_ticks = cpu;
+    e->io_bytes = io;
+    e->rss_bytes = rss * procs_page_size;
+    e->read_time = now;
+}
+
+/* Lists the next chunk of /proc. Returns 1 when the pass is complete. */
+int procs_scan_dir(void) {
+    char *dents = procs_dents;
+    long n = syscall(SYS_getdents64, procs_dirfd, dents, sizeof(procs_dents));
+    if (n <= 0) return 1;
+    for (long off = 0; off < n; ) {
+        struct linux_dirent64 *d = (struct linux_dirent64 *)(dents + off);
+        off += d->d_reclen;
+        const char *name = d->d_name;
+        if ((unsigned)(*name - '0') >= 10) continue;
+        int pid = (int)scan_u64(&name);
+        proc_entry_t *e = ptab_insert(&procs, pid);
+        if (e) e->pass = procs_pass;
+    }
+    return 0;
+}
+
+double proc_key(const proc_entry_t *e, int key) {
+    if (key == PROCS_SORT_RSS) return e->rss_bytes;
+    if (key == PROCS_SORT_IO) return e->io_bps;
+    return e->cpu_pct;
+}
+
+/* Partial top-N: a size-N min-heap of slot indices over one pass of the
+ * table, O(P log N), then the N survivors are ordered largest first. */
+void procs_select_top(int key, int n) {
+    int *h = procs_top;
+    int len = 0;
+    for (size_t i = 0; i < procs.cap; i++) {
+        const proc_entry_t *e = &procs.slots[i];
+        if (e->pid == 0 || e->dead || !e->has_rates) continue;
+        double v = proc_key(e, key);
+        if (len == n && v <= proc_key(&procs.slots[h[0]], key)) continue;
+        int k;
+        if (len < n) {
+            /* sift up */
+            k = len++;
+            while (k > 0 && proc_key(&procs.slots[h[(k - 1) / 2]], key) > v) {
+                h[k] = h[(k - 1) / 2];
+                k = (k - 1) / 2;
+            }
+        } else {
+            /* replace the root and sift down */
+            k = 0;
+            for (;;) {
+                int c = 2 * k + 1;
+                if (c >= len) break;
+                if (c + 1 < len && proc_key(&procs.slots[h[c + 1]], key) < proc_key(&procs.slots[h[c]], key)) c++;
+                if (proc_key(&procs.slots[h[c]], key) >= v) break;
+                h[k] = h[c];
+                k = c;
+            }
+        }
+        h[k] = (int)i;
+    }
+    /* heap sort in place: repeatedly move the minimum to the back */
+    for (int end = len - 1; end > 0; end--) {
+        int top = h[0];
+        int last = h[end];
+        double v = proc_key(&procs.slots[last], key);
+        int k = 0;
+        for (;;) {
+            int c = 2 * k + 1;
+            if (c >= end) break;
+            if (c + 1 < end && proc_key(&procs.slots[h[c + 1]], key) < proc_key(&procs.slots[h[c]], key)) c++;
+            if (proc_key(&procs.slots[h[c]], key) >= v) break;
+            h[k] = h[c];
+            k = c;
+        }
+        h[k] = last;
+        h[end] = top;
+    }
+    procs_top_count = len;
+    for (int i = 0; i < len; i++) procs.slots[h[i]].top_tick = procs_tick;
+}
+
+int procs_init(void) {
+    procs_dirfd = open("/proc", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (procs_dirfd < 0 || ptab_init(&procs, 1024) != 0) return -1;
+    procs_clk_tck = sysconf(_SC_CLK_TCK);
+    procs_page_size = sysconf(_SC_PAGESIZE);
+    
+    fd_cache_init();
+    if (opt_procs > (int)(sizeof(procs_top) / sizeof(procs_top[0]))) {
+        opt_procs = sizeof(procs_top) / sizeof(procs_top[0]);
+    }
+    
+    /* One unbounded pass at startup sets every baseline; ticks then only
+     * have to pick up new PIDs */
+    while (!procs_scan_dir()) {}
+    double now = get_time_sec();
+    for (size_t i = 0; i < procs.cap; i++) {
+        if (procs.slots[i].pid != 0) proc_refresh(&procs.slots[i], now);
+    }
+    procs_pass++;
+    lseek(procs_dirfd, 0, SEEK_SET);
+    return 0;
+}
+
+void sample_procs(void) {
+    if (procs_dirfd < 0) return;
+    double t0 = get_time_sec();
+    procs_tick++;
+    
+    if (procs_scan_dir()) {
+        /* Pass complete: anything not listed since it started has exited */
+        for (size_t i = 0; i < procs.cap; i++) {
+            proc_entry_t *e = &procs.slots[i];
+            if (e->pid != 0 && !e->dead && e->pass != procs_pass) {
+                e->dead = 1;
+                procs_dead++;
+            }
+        }
+        procs_pass++;
+        lseek(procs_dirfd, 0, SEEK_SET);
+    }
+    
+    /* The clock is checked every 32 reads; each read costs a few us */
+    double now = get_time_sec();
+    double deadline = now + PROCS_READ_BUDGET_MS / 1000.0;
+    size_t mask = procs.cap - 1;
+    int reads = 0, over = 0;
+    for (size_t n = 0; n < procs.cap && !over; n++) {
+        size_t i = (procs_hot_cursor + n) & mask;
+        proc_entry_t *e = &procs.slots[i];
+        if (e->pid == 0 || e->dead) continue;
+        if (e->fresh || e->hot || e->top_tick + 1 == procs_tick) {
+            proc_refresh(e, now);
+            if (++reads % 32 == 0 && get_time_sec() > deadline) {
+                procs_hot_cursor = i + 1;
+                over = 1;
+            }
+        }
+    }
+    for (size_t n = 0; n < procs.cap && !over; n++) {
+        procs_cursor = (procs_cursor + 1) & mask;
+        proc_entry_t *e = &procs.slots[procs_cursor];
+        if (e->pid == 0 || e->dead || e->read_tick == procs_tick) continue;
+        proc_refresh(e, now);
+        if (++reads % 32 == 0 && get_time_sec() > deadline) over = 1;
+    }
+    
+    /* Sweep: a removal shifts a later entry into slot i, so re-check it */
+    for (size_t i = 0; i < procs.cap && procs_dead > 0; ) {
+        if (procs.slots[i].pid != 0 && procs.slots[i].dead) {
+            ptab_remove(&procs, i);
+            procs_dead--;
+        } else {
+            i++;
+        }
+    }
+    
+    procs_select_top(opt_procs_sort, opt_procs);
+    procs_scan_ms = (get_time_sec() - t0) * 1000.0;
+}
+
+/* PSI: /proc/pressure/{cpu,memory,io}. The stall rate is the share of
+ * wall time some (or all) tasks were stalled since the previous read,
+ * from the cumulative total counters; avg10 is reported as the kernel
+ * computes it. */
+const char *psi_names[PSI_COUNT] = { "cpu", "memory", "io" };
+const char *psi_paths[PSI_COUNT] = { "/proc/pressure/cpu", "/proc/pressure/memory", "/proc/pressure/io" };
+proc_src_t src_psi[PSI_COUNT] = { { .fd = -1 }, { .fd = -1 }, { .fd = -1 } };
+
+int opt_psi = 0;
+int opt_psi_trigger_ms = 0;
+int psi_triggers_armed = 0;
+unsigned long long psi_wakeups = 0;
+
+void parse_psi_line(const char *line, double *avg10, unsigned long long *total) {
+    const char *a = strstr(line, "avg10=");
+    const char *t = strstr(line, "total=");
+    if (a) *avg10 = strtod(a + 6, NULL);
+    if (t) {
+        t += 6;
+        *total = scan_u64(&t);
+    }
+}
+
+void sample_psi(proc_snapshot_t *s) {
+    s->psi_time = sample_clock("clock:psi");
+    for (int r = 0; r < PSI_COUNT; r++) {
+        psi_stats_t *p = &s->psi[r];
+        memset(p, 0, sizeof(*p));
+        if (src_read(&src_psi[r]) != 0) continue;
+        
+        char *pos = src_psi[r].buf, *line;
+        while ((line = src_next_line(&pos)) != NULL) {
+            if (strncmp(line, "some ", 5) == 0) parse_psi_line(line, &p->some_avg10, &p->some_total);
+            else if (strncmp(line, "full ", 5) == 0) parse_psi_line(line, &p->full_avg10, &p->full_total);
+        }
+        p->ok = 1;
+    }
+}
+
+int psi_trigger_fired(int fd, uint32_t events) {
+    /* EPOLLERR: the pressure file went away, stop watching it */
+    if (events & EPOLLERR) {
+        sched_unwatch(fd);
+        close(fd);
+        psi_triggers_armed--;
+        return 0;
+    }
+    psi_wakeups++;
+    return 1;
+}
+
+/* Registers a "some" trigger per resource: the kernel raises POLLPRI when
+ * stall time exceeds opt_psi_trigger_ms within a one-second window, and
+ * the tick wait returns early. Unprivileged triggers need a window that
+ * is a multiple of two seconds, which is tried second. */
+void psi_triggers_init(void) {
+    static const int windows_us[] = { 1000000, 2000000 };
+    for (int r = 0; r < PSI_COUNT; r++) {
+        int fd = open(psi_paths[r], O_RDWR | O_NONBLOCK | O_CLOEXEC);
+        if (fd < 0) continue;
+        int ok = 0;
+        for (int w = 0; w < 2 && !ok; w++) {
+            char spec[64];
+            snprintf(spec, sizeof(spec), "some %d %d", opt_psi_trigger_ms * 1000, windows_us[w]);
+            ok = write(fd, spec, strlen(spec) + 1) >= 0;
+        }
+        if (!ok || sched_watch(fd, EPOLLPRI, psi_trigger_fired) != 0) {
+            close(fd);
+            continue;
+        }
+        psi_triggers_armed++;
+    }
+}
+
+/* cgroup v2 Collector
+ *
+ * --cgroup PATH|all follows one subtree of the unified hierarchy. Every
+ * cgroup keeps its directory fd, and cpu.stat, memory.current and io.stat
+ * are read through openat() relative to it with cached fds, so a tick is
+ * three preads per cgroup. The tree itself is only re-walked every
+ * CGROUP_RESCAN_SEC seconds (or right after a cgroup disappears); a walk
+ * lists each known directory through its cached fd and carries counters
+ * and fds over by path. Like the CPU table, each entry keeps the previous
+ * counters next to the current ones and rates come from their delta. */
+#define CGROUP_RESCAN_SEC 5.0
+#define CGROUP_ROWS 20
+
+typedef struct {
+    char *path;                 /* relative to the cgroup2 root, "" for the root */
+    int dirfd;
+    int cpu_fd, mem_fd, io_fd;
+    unsigned char has_mem, has_io, gone, valid;
+    unsigned long long usage_usec, prev_usage_usec;
+    unsigned long long rbytes, prev_rbytes;
+    unsigned long long wbytes, prev_wbytes;
+    double mem_bytes;
+    double time, prev_time;
+    double cpu_pct, io_rbps, io_wbps;
+} cgroup_t;
+
+char *opt_cgroup = NULL;
+char cgroup_root[256] = "";
+char cgroup_base[256] = "";
+cgroup_t *cgroups = NULL;
+int cgroup_count = 0;
+int cgroup_cap = 0;
+double cgroup_scan_time = 0;
+int *cgroup_order = NULL;
+
+void cgroup_close(cgroup_t *cg) {
+    fd_cache_close(&cg->cpu_fd);
+    fd_cache_close(&cg->mem_fd);
+    fd_cache_close(&cg->io_fd);
+    if (cg->dirfd >= 0) close(cg->dirfd);
+    cg->dirfd = -1;
+    free(cg->path);
+    cg->path = NULL;
+}
+
+/* Locates the cgroup2 mount and resolves opt_cgroup to a path below it */
+int cgroup_find_root(void) {
+    FILE *mtab = setmntent("/proc/self/mounts", "r");
+    if (!mtab) return -1;
+    struct mntent *ent;
+    while ((ent = getmntent(mtab)) != NULL) {
+        if (strcmp(ent->mnt_type, "cgroup2") == 0) {
+            snprintf(cgroup_root, sizeof(cgroup_root), "%s", ent->mnt_dir);
+            break;
+        }
+    }
+    endmntent(mtab);
+    if (!cgroup_root[0]) return -1;
+    
+    const char *base = strcmp(opt_cgroup, "all") == 0 ? "" : opt_cgroup;
+    size_t rlen = strlen(cgroup_root);
+    if (strncmp(base, cgroup_root, rlen) == 0) base += rlen;
+    while (*base == '/') base++;
+    snprintf(cgroup_base, sizeof(cgroup_base), "%s", base);
+    size_t blen = strlen(cgroup_base);
+    while (blen > 0 && cgroup_base[blen - 1] == '/') cgroup_base[--blen] = '\0';
+    return 0;
+}
+
+int cgroup_append(cgroup_t **list, int *count, int *cap, const cgroup_t *cg) {
+    if (*count == *cap) {
+        int ncap = *cap ? *cap * 2 : 64;
+        cgroup_t *nl = realloc(*list, ncap * sizeof(cgroup_t));
+        if (!nl) return -1;
+        *list = nl;
+        *cap = ncap;
+    }
+    (*list)[(*count)++] = *cg;
+    return 0;
+}
+
+/* Takes over the entry already known under path, or opens a new one
+ * (by path from the root when parent_fd is -1). Returns 0 on success. */
+int cgroup_carry(int *ix, size_t ix_cap, const char *path, int parent_fd, const char *name, cgroup_t *out) {
+    for (size_t h = name_hash(path) & (ix_cap - 1); ix[h]; h = (h + 1) & (ix_cap - 1)) {
+        if (ix[h] > 0 && strcmp(cgroups[ix[h] - 1].path, path) == 0) {
+            *out = cgroups[ix[h] - 1];
+            cgroups[ix[h] - 1].path = NULL;
+            ix[h] = -1;
+            return 0;
+        }
+    }
+    memset(out, 0, sizeof(*out));
+    out->cpu_fd = out->mem_fd = out->io_fd = -1;
+    out->has_mem = out->has_io = 1;
+    if (parent_fd < 0) {
+        char full[4096];
+        snprintf(full, sizeof(full), "%s/%s", cgroup_root, path);
+        out->dirfd = open(full, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    } else {
+        out->dirfd = openat(parent_fd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    }
+    out->path = strdup(path);
+    if (out->dirfd < 0 || !out->path) {
+        cgroup_close(out);
+        return -1;
+    }
+    return 0;
+}
+
+/* Walks the subtree breadth-first, carrying every known entry over by path
+ * and closing the ones that vanished */
+void cgroup_rescan(void) {
+    size_t ix_cap = 64;
+    while (ix_cap < (size_t)cgroup_count * 2 + 2) ix_cap *= 2;
+    int *ix = calloc(ix_cap, sizeof(int));
+    if (!ix) return;
+    for (int i = 0; i < cgroup_count; i++) {
+        size_t h = name_hash(cgroups[i].path) & (ix_cap - 1);
+        while (ix[h]) h = (h + 1) & (ix_cap - 1);
+        ix[h] = i + 1;
+    }
+    
+    cgroup_t *next = NULL;
+    int next_count = 0, next_cap = 0;
+    cgroup_t cg;
+    if (cgroup_carry(ix, ix_cap, cgroup_base, -1, NULL, &cg) == 0 &&
+        cgroup_append(&next, &next_count, &next_cap, &cg) != 0) {
+        cgroup_close(&cg);
+    }
+    
+    char dents[8192];
+    char path[4096];
+    for (int i = 0; i < next_count; i++) {
+        int parent_fd = next[i].dirfd;
+        const char *parent_path = next[i].path;
+        lseek(parent_fd, 0, SEEK_SET);
+        long n;
+        while ((n = syscall(SYS_getdents64, parent_fd, dents, sizeof(dents))) > 0) {
+            for (long off = 0; off < n; ) {
+                struct linux_dirent64 *d = (struct linux_dirent64 *)(dents + off);
+                off += d->d_reclen;
+                if (d->d_type != DT_DIR || d->d_name[0] == '.') continue;
+                snprintf(path, sizeof(path), "%s%s%s", parent_path, parent_path[0] ? "/" : "", d->d_name);
+                if (cgroup_carry(ix, ix_cap, path, parent_fd, d->d_name, &cg) != 0) continue;
+                if (cgroup_append(&next, &next_count, &next_cap, &cg) != 0) cgroup_close(&cg);
+            }
+        }
+    }
+    
+    for (int i = 0; i < cgroup_count; i++) {
+        if (cgroups[i].path) cgroup_close(&cgroups[i]);
+    }
+    free(cgroups);
+    free(ix);
+    cgroups = next;
+    cgroup_count = next_count;
+    cgroup_cap = next_cap;
+    int *order = realloc(cgroup_order, (cgroup_count + 1) * sizeof(int));
+    if (order) cgroup_order = order;
+    cgroup_scan_time = get_time_sec();
+}
+
+/* Sums rbytes= and wbytes= over every device line of io.stat */
+void parse_io_stat(const char *buf, unsigned long long *rbytes, unsigned long long *wbytes) {
+    *rbytes = *wbytes = 0;
+    for (const char *p = buf; (p = strstr(p, "bytes=")) != NULL; ) {
+        char kind = p > buf ? p[-1] : 0;
+        p += 6;
+        unsigned long long v = scan_u64(&p);
+        if (kind == 'r') *rbytes += v;
+        else if (kind == 'w') *wbytes += v;
+    }
+}
+
+void cgroup_refresh(cgroup_t *cg, double now) {
+    char buf[4096];
+    cg->prev_usage_usec = cg->usage_usec;
+    cg->prev_rbytes = cg->rbytes;
+    cg->prev_wbytes = cg->wbytes;
+    cg->prev_time = cg->time;
+    
+    if (read_cached_at(cg->dirfd, "cpu.stat", &cg->cpu_fd, buf, sizeof(buf)) < 0) {
+        cg->gone = 1;
+        return;
+    }
+    const char *u = strstr(buf, "usage_usec ");
+    if (u) {
+        u += 11;
+        cg->usage_usec = scan_u64(&u);
+    }
+    if (cg->has_mem) {
+        if (read_cached_at(cg->dirfd, "memory.current", &cg->mem_fd, buf, sizeof(buf)) > 0) {
+            cg->mem_bytes = strtod(buf, NULL);
+        } else {
+            cg->has_mem = 0;
+        }
+    }
+    if (cg->has_io) {
+        if (read_cached_at(cg->dirfd, "io.stat", &cg->io_fd, buf, sizeof(buf)) >= 0) {
+            parse_io_stat(buf, &cg->rbytes, &cg->wbytes);
+        } else {
+            cg->has_io = 0;
+        }
+    }
+    cg->time = now;
+    
+    double dt = cg->time - cg->prev_time;
+    cg->valid = (cg->prev_time > 0 && dt > 0);
+    if (!cg->valid) return;
+    cg->cpu_pct = cg->usage_usec >= cg->prev_usage_usec ? (cg->usage_usec - cg->prev_usage_usec) / (dt * 1e6) * 100.0 : 0;
+    cg->io_rbps = cg->rbytes >= cg->prev_rbytes ? (cg->rbytes - cg->prev_rbytes) / dt : 0;
+    cg->io_wbps = cg->wbytes >= cg->prev_wbytes ? (cg->wbytes - cg->prev_wbytes) / dt : 0;
+}
+
+int cgroup_cmp_cpu(const void *a, const void *b) {
+    const cgroup_t *x = &cgroups[*(const int *)a], *y = &cgroups[*(const int *)b];
+    if (x->cpu_pct != y->cpu_pct) return x->cpu_pct < y->cpu_pct ? 1 : -1;
+    return x->mem_bytes < y->mem_bytes ? 1 : (x->mem_bytes > y->mem_bytes ? -1 : 0);
+}
+
+int cgroups_init(void) {
+    if (cgroup_find_root() != 0) return -1;
+    fd_cache_init();
+    cgroup_rescan();
+    return cgroup_count > 0 ? 0 : -1;
+}
+
+void sample_cgroups(void) {
+    if (!cgroup_root[0]) return;
+    double now = get_time_sec();
+    if (now - cgroup_scan_time >= CGROUP_RESCAN_SEC) cgroup_rescan();
+    
+    int gone = 0;
+    for (int i = 0; i < cgroup_count; i++) {
+        cgroup_refresh(&cgroups[i], now);
+        gone |= cgroups[i].gone;
+    }
+    /* Let the next tick's walk drop removed cgroups */
+    if (gone) cgroup_scan_time = 0;
+}
+
+/* Self-Profiling
+ * With --selfstat each collector, the sample computation, the log and ring
+ * sinks and the renderer are timed on the monotonic clock. The last
+ * SELF_WINDOW durations of every stage stay in a ring, and self_tick()
+ * reduces them to p50 and p99 once per tick, together with the rusage
+ * delta of the whole process (worker threads included). Without the
+ * option the hooks return before reading the clock. */
+enum {
+    STAGE_CPU, STAGE_MEM, STAGE_DISK, STAGE_DISKIO, STAGE_NET, STAGE_PROCS, STAGE_PSI,
+    STAGE_CGROUP, STAGE_COMPUTE, STAGE_LOG, STAGE_RENDER, STAGE_EXPORT, STAGE_COUNT
+};
+
+#define SELF_WINDOW 256
+
+const char *stage_names[STAGE_COUNT] = {
+    "cpu", "mem", "disk", "diskio", "net", "procs", "psi", "cgroup", "compute", "log", "render", "export"
+};
+int opt_selfstat = 0;
+float self_ring[STAGE_COUNT][SELF_WINDOW];  /* microseconds */
+int self_len[STAGE_COUNT];
+int self_pos[STAGE_COUNT];
+double self_p50[STAGE_COUNT];
+double self_p99[STAGE_COUNT];
+double self_cpu_pct = 0;
+double self_maxrss = 0;
+struct rusage self_ru_prev;
+double self_ru_time = 0;
+
+long long self_begin(void) {
+    if (!opt_selfstat) return 0;
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+void self_end(int stage, long long t0) {
+    if (!opt_selfstat) return;
+    self_ring[stage][self_pos[stage]] = (float)((self_begin() - t0) / 1000.0);
+    self_pos[stage] = (self_pos[stage] + 1) % SELF_WINDOW;
+    if (self_len[stage] < SELF_WINDOW) self_len[stage]++;
+}
+
+/* Quickselect: the k-th smallest of v[0..n), reordering v */
+float self_select(float *v, int n, int k) {
+    int lo = 0, hi = n - 1;
+    while (lo < hi) {
+        float pivot = v[(lo + hi) / 2];
+        int i = lo, j = hi;
+        while (i <= j) {
+            while (v[i] < pivot) i++;
+            while (v[j] > pivot) j--;
+            if (i <= j) {
+                float t = v[i];
+                v[i++] = v[j];
+                v[j--] = t;
+            }
+        }
+        if (k <= j) hi = j;
+        else if (k >= i) lo = i;
+        else break;
+    }
+    return v[k];
+}
+
+void self_tick(void) {
+    if (!opt_selfstat) return;
+    float tmp[SELF_WINDOW];
+    for (int st = 0; st < STAGE_COUNT; st++) {
+        int n = self_len[st];
+        self_p50[st] = self_p99[st] = 0;
+        if (n == 0) continue;
+        memcpy(tmp, self_ring[st], n * sizeof(float));
+        self_p99[st] = self_select(tmp, n, (n * 99 + 99) / 100 - 1);
+        self_p50[st] = self_select(tmp, n, (n - 1) / 2);
+    }
+    
+    struct rusage ru;
+    double now = get_time_sec();
+    if (getrusage(RUSAGE_SELF, &ru) != 0) return;
+    if (self_ru_time > 0 && now > self_ru_time) {
+        double cpu = (ru.ru_utime.tv_sec - self_ru_prev.ru_utime.tv_sec) +
+                     (ru.ru_utime.tv_usec - self_ru_prev.ru_utime.tv_usec) / 1e6 +
+                     (ru.ru_stime.tv_sec - self_ru_prev.ru_stime.tv_sec) +
+                     (ru.ru_stime.tv_usec - self_ru_prev.ru_stime.tv_usec) / 1e6;
+        self_cpu_pct = cpu / (now - self_ru_time) * 100.0;
+    }
+    self_maxrss = ru.ru_maxrss * 1024.0;
+    self_ru_prev = ru;
+    self_ru_time = now;
+}
+
+/* Collector Scheduling
+ * cpu, mem, disk (capacity), diskio and net can each refresh on their own
+ * period (--period NAME=MS); a collector without one follows --interval.
+ * Periodic collectors sit in a hashed timer wheel of WHEEL_SLOTS buckets,
+ * WHEEL_RES_MS wide, keyed by their absolute deadline. Each tick sweeps
+ * the buckets it has passed and fires the collectors whose deadline is
+ * reached; longer periods simply stay in their bucket for more rounds.
+ * A collector that is not due carries its counters into the new
+ * snapshot, so its next delta spans its whole period and the sample
+ * keeps its last computed values for the renderer and the log. */
+enum { COLL_CPU, COLL_MEM, COLL_DISK, COLL_DISKIO, COLL_NET, COLL_COUNT };
+
+#define WHEEL_SLOTS 256
+#define WHEEL_RES_MS 10
+
+const char *col_names[COLL_COUNT] = { "cpu", "mem", "disk", "diskio", "net" };
+int opt_period[COLL_COUNT];
+int col_due[COLL_COUNT] = { 1, 1, 1, 1, 1 };
+long long col_deadline[COLL_COUNT];
+int col_next[COLL_COUNT];
+int wheel_head[WHEEL_SLOTS];
+long long wheel_now = -1;
+
+void wheel_insert(int c, long long deadline) {
+    int slot = (int)(deadline % WHEEL_SLOTS);
+    col_deadline[c] = deadline;
+    col_next[c] = wheel_head[slot];
+    wheel_head[slot] = c;
+}
+
+/* Parses "cpu=50,disk=10000"; periods round up to the wheel resolution */
+int parse_periods(const char *spec) {
+    char buf[256];
+    snprintf(buf, sizeof(buf), "%s", spec);
+    for (char *save = NULL, *tok = strtok_r(buf, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+        char *eq = strchr(tok, '=');
+        if (!eq) return -1;
+        *eq = '\0';
+        int c = 0;
+        while (c < COLL_COUNT && strcmp(col_names[c], tok) != 0) c++;
+        int ms = atoi(eq + 1);
+        if (c == COLL_COUNT || ms < 1) return -1;
+        opt_period[c] = (ms + WHEEL_RES_MS - 1) / WHEEL_RES_MS * WHEEL_RES_MS;
+    }
+    return 0;
+}
+
+/* The tick has to be at least as fast as the fastest collector. When that
+ * is faster than the refresh interval, the other collectors keep to the
+ * interval instead of following the tick. */
+int collectors_tick_ms(int interval_ms) {
+    int tick_ms = interval_ms;
+    for (int c = 0; c < COLL_COUNT; c++) {
+        if (opt_period[c] > 0 && opt_period[c] < tick_ms) tick_ms = opt_period[c];
+    }
+    for (int c = 0; tick_ms < interval_ms && c < COLL_COUNT; c++) {
+        if (opt_period[c] == 0) opt_period[c] = (interval_ms + WHEEL_RES_MS - 1) / WHEEL_RES_MS * WHEEL_RES_MS;
+    }
+    return tick_ms;
+}
+
+/* Places every periodic collector due on the first tick */
+void wheel_init(void) {
+    for (int i = 0; i < WHEEL_SLOTS; i++) wheel_head[i] = -1;
+    for (int c = 0; c < COLL_COUNT; c++) {
+        if (opt_period[c] > 0) wheel_insert(c, 0);
+    }
+}
+
+/* Sweeps the buckets up to time t and sets col_due[] for this tick. Half
+ * a bucket of slack keeps a tick that lands right on a deadline from
+ * being pushed to the next one. */
+void wheel_advance(double t) {
+    long long target = (long long)(((t - mono_anchor) * 1000.0 + WHEEL_RES_MS / 2) / WHEEL_RES_MS);
+    for (int c = 0; c < COLL_COUNT; c++) col_due[c] = (opt_period[c] == 0);
+    if (target <= wheel_now) return;
+    long long from = target - wheel_now > WHEEL_SLOTS ? target - WHEEL_SLOTS + 1 : wheel_now + 1;
+    wheel_now = target;
+    for (long long tk = from; tk <= target; tk++) {
+        int *link = &wheel_head[tk % WHEEL_SLOTS];
+        while (*link >= 0) {
+            int c = *link;
+            if (col_deadline[c] > target) {
+                link = &col_next[c];
+                continue;
+            }
+            *link = col_next[c];
+            col_due[c] = 1;
+            long long period = opt_period[c] / WHEEL_RES_MS;
+            long long next = col_deadline[c] + period;
+            if (next <= target) next = target + period;
+            wheel_insert(c, next);
+        }
+    }
+}
+
+/* Reads every enabled source that is due exactly once per tick */
+void take_snapshot(proc_snapshot_t *s, int show_cpu, int show_mem, int show_disks, int show_net) {
+    s->time = replay_active ? replay_now : get_time_sec();
+    if (record_fd >= 0) record_tick(s->time);
+    wheel_advance(s->time);
+    if (show_cpu) {
+        if (col_due[COLL_CPU]) {
+            long long t0 = self_begin();
+            sample_cpu(s);
+            self_end(STAGE_CPU, t0);
+        } else {
+            s->total = snap_prev->total;
+            cpu_table_copy(&s->cores, &snap_prev->cores);
+        }
+    }
+    if (show_mem && col_due[COLL_MEM]) {
+        long long t0 = self_begin();
+        sample_memory(s);
+        self_end(STAGE_MEM, t0);
+    }
+    if (show_disks && col_due[COLL_DISK]) {
+        long long t0 = self_begin();
+        sample_disks(s);
+        self_end(STAGE_DISK, t0);
+    }
+    if (show_disks) {
+        if (col_due[COLL_DISKIO]) {
+            long long t0 = self_begin();
+            sample_diskio(s);
+            self_end(STAGE_DISKIO, t0);
+        } else {
+            memcpy(s->diskio, snap_prev->diskio, snap_prev->diskio_count * sizeof(diskio_stats_t));
+            s->diskio_count = snap_prev->diskio_count;
+            s->diskio_time = snap_prev->diskio_time;
+        }
+    }
+    if (show_net) {
+        if (col_due[COLL_NET]) {
+            long long t0 = self_begin();
+            sample_net(s);
+            self_end(STAGE_NET, t0);
+        } else {
+            s->net_time = snap_prev->net_time;
+        }
+    }
+    if (opt_procs) {
+        long long t0 = self_begin();
+        sample_procs();
+        self_end(STAGE_PROCS, t0);
+    }
+    if (opt_psi) {
+        long long t0 = self_begin();
+        sample_psi(s);
+        self_end(STAGE_PSI, t0);
+    }
+    if (opt_cgroup) {
+        long long t0 = self_begin();
+        sample_cgroups();
+        self_end(STAGE_CGROUP, t0);
+    }
+}
+
+/* Makes the current snapshot the baseline for the next tick's deltas */
+void rotate_snapshots(void) {
+    proc_snapshot_t *t = snap_prev;
+    snap_prev = snap;
+    snap = t;
+}
+
+/* Per-tick sample with all deltas and rates already computed. Renderers and
+ * sinks (CSV log, exporters) read only this and never touch the sources. */
+typedef struct {
+    char name[32];
+    double rx_bps;
+    double tx_bps;
+    double rx_pct;
+    double tx_pct;
+    int valid;
+    int slot;                   /* iftab slot of the interface */
+} net_sample_t;
+
+typedef struct {
+    char name[32];
+    double r_iops, w_iops;
+    double r_bps, w_bps;
+    double util_pct;
+    double await_ms;
+    double queue;
+    int valid;
+} diskio_sample_t;
+
+typedef struct {
+    double some_avg10, full_avg10;
+    double some_stall, full_stall;
+    int ok;
+} psi_sample_t;
+
+typedef struct {
+    double mono;
+    double wall;
+    double cpu_total;
+    double *cpu_cores;
+    double ram_used, ram_total, ram_pct;
+    double swap_used, swap_total, swap_pct;
+    disk_stats_t disks[MAX_DISKS];
+    int disk_count;
+    diskio_sample_t diskio[MAX_DISKIO];
+    int diskio_count;
+    int diskio_ready;
+    net_sample_t *net;
+    int net_count;
+    int net_cap;
+    int net_ready;
+    psi_sample_t psi[PSI_COUNT];
+    int psi_ready;
+} sample_t;
+
+sample_t cur_sample;
+
+diskio_stats_t *find_prev_diskio(const char *name) {
+    for (int i = 0; i < snap_prev->diskio_count; i++) {
+        if (strcmp(snap_prev->diskio[i].name, name) == 0) return &snap_prev->diskio[i];
+    }
+    return NULL;
+}
+
+/* Metric History
+ * Total CPU, every core, RAM, swap and both directions of every interface
+ * keep their last opt_history samples in a ring. The rolling min and max
+ * come from monotonic deques of ring positions, the average from a running
+ * sum and p95 from a histogram, so a sample costs O(1) amortized. The
+ * histogram's buckets split [0, top], where top is a power of two that
+ * follows the window's max: it doubles when the max outgrows it and halves
+ * while the max is under a quarter of it, and the buckets are rebuilt from
+ * the ring when it moves. An interface idling below 1% gets the same
+ * resolution as a busy core. Rings are allocated when a metric first
+ * appears and reused after that; a collector that was not due on a tick
+ * adds nothing. */
+#define HIST_DEFAULT 60
+#define HIST_MAX 3600
+#define HIST_BUCKETS 101
+#define HIST_MIN_TOP (1.0f / 1024)
+#define HIST_MAX_TOP (1024.0f * 1024)
+#define SPARK_WIDTH 20
+#define SPARK_CORE_WIDTH 8
+
+typedef struct {
+    float *vals;                /* ring of opt_history values, in percent */
+    int *max_q;                 /* ring positions with decreasing values */
+    int *min_q;                 /* ring positions with increasing values */
+    int max_head, max_len;
+    int min_head, min_len;
+    int pos;                    /* where the next value goes */
+    int count;
+    double sum;
+    float top;                  /* value of the last bucket */
+    unsigned short hist[HIST_BUCKETS];
+} series_t;
+
+int opt_history = HIST_DEFAULT;
+int spark_utf8 = 0;
+series_t hist_cpu, hist_ram, hist_swap;
+series_t *hist_cores = NULL;
+series_t *hist_net = NULL;      /* rx then tx of each iftab slot */
+int hist_net_slots = 0;
+
+int series_alloc(series_t *s) {
+    memset(s, 0, sizeof(*s));
+    s->vals = malloc((size_t)opt_history * (sizeof(float) + 2 * sizeof(int)));
+    if (!s->vals) return -1;
+    s->max_q = (int *)(s->vals + opt_history);
+    s->min_q = s->max_q + opt_history;
+    s->top = HIST_MIN_TOP;
+    return 0;
+}
+
+void series_reset(series_t *s) {
+    s->max_head = s->max_len = s->min_head = s->min_len = 0;
+    s->pos = s->count = 0;
+    s->sum = 0;
+    s->top = HIST_MIN_TOP;
+    memset(s->hist, 0, sizeof(s->hist));
+}
+
+int hist_bucket(const series_t *s, float v) {
+    if (!(v > 0)) return 0;
+    float b = v / s->top * (HIST_BUCKETS - 1) + 0.5f;
+    return b >= HIST_BUCKETS - 1 ? HIST_BUCKETS - 1 : (int)b;
+}
+
+/* Until the ring is full its values sit at [0, count) */
+void series_rebin(series_t *s, float top) {
+    s->top = top;
+    memset(s->hist, 0, sizeof(s->hist));
+    for (int i = 0; i < s->count; i++) s->hist[hist_bucket(s, s->vals[i])]++;
+}
+
+void series_push(series_t *s, double value) {
+    int cap = opt_history;
+    int pos = s->pos;
+    float v = (float)value;
+    if (s->count == cap) {
+        /* The oldest value leaves; in a deque it can only be at the front */
+        float old = s->vals[pos];
+        s->sum -= old;
+        s->hist[hist_bucket(s, old)]--;
+        if (s->max_q[s->max_head] == pos) {
+            s->max_head = (s->max_head + 1) % cap;
+            s->max_len--;
+        }
+        if (s->min_q[s->min_head] == pos) {
+            s->min_head = (s->min_head + 1) % cap;
+            s->min_len--;
+        }
+    } else {
+        s->count++;
+    }
+    while (s->max_len > 0 && s->vals[s->max_q[(s->max_head + s->max_len - 1) % cap]] <= v) s->max_len--;
+    s->max_q[(s->max_head + s->max_len++) % cap] = pos;
+    while (s->min_len > 0 && s->vals[s->min_q[(s->min_head + s->min_len - 1) % cap]] >= v) s->min_len--;
+    s->min_q[(s->min_head + s->min_len++) % cap] = pos;
+    s->vals[pos] = v;
+    s->sum += v;
+    float top = s->top, max = s->vals[s->max_q[s->max_head]];
+    while (top < max && top < HIST_MAX_TOP) top *= 2;
+    while (top > HIST_MIN_TOP && max < top / 4) top /= 2;
+    if (top != s->top) series_rebin(s, top);
+    else s->hist[hist_bucket(s, v)]++;
+    s->pos = (pos + 1) % cap;
+    /* Re-adding the window once per lap keeps rounding from building up */
+    if (s->pos == 0) {
+        s->sum = 0;
+        for (int i = 0; i < cap; i++) s->sum += s->vals[i];
+    }
+}
+
+double series_min(const series_t *s) { return s->vals[s->min_q[s->min_head]]; }
+double series_max(const series_t *s) { return s->vals[s->max_q[s->max_head]]; }
+double series_avg(const series_t *s) { return s->sum / s->count; }
+
+/* The value with at least 95% of the window at or below it, to within a
+ * bucket; kept inside [min, max] so a steady series reports its value */
+double series_p95(const series_t *s) {
+    int rank = (s->count * 95 + 99) / 100, seen = 0, b;
+    for (b = 0; b < HIST_BUCKETS - 1; b++) {
+        seen += s->hist[b];
+        if (seen >= rank) break;
+    }
+    double p = (double)b * s->top / (HIST_BUCKETS - 1);
+    double lo = series_min(s), hi = series_max(s);
+    return p < lo ? lo : p > hi ? hi : p;
+}
+
+/* The last width values as an eight-level sparkline scaled to top, oldest
+ * first and right-aligned; size must hold width * 3 + 1 bytes */
+void series_spark(const series_t *s, int width, double top, char *buf, size_t size) {
+    static const char ramp[] = "_.:-=+*#";
+    size_t len = 0;
+    int n = s->count < width ? s->count : width;
+    for (int i = n; i < width && len + 1 < size; i++) buf[len++] = ' ';
+    for (int i = n; i > 0 && len + 4 <= size; i--) {
+        float v = s->vals[(s->pos - i + opt_history) % opt_history];
+        int level = top > 0 ? (int)(v / top * 8) : 0;
+        if (level > 7) level = 7;
+        if (level < 0) level = 0;
+        if (spark_utf8) {
+            buf[len++] = (char)0xE2;
+            buf[len++] = (char)0x96;
+            buf[len++] = (char)(0x81 + level);
+        } else {
+            buf[len++] = ramp[level];
+        }
+    }
+    buf[len] = '\0';
+}
+
+/* Sparklines use block elements when the locale is UTF-8 */
+int history_init(void) {
+    if (opt_history <= 0) return 0;
+    const char *loc = getenv("LC_ALL");
+    if (!loc || !*loc) loc = getenv("LC_CTYPE");
+    if (!loc || !*loc) loc = getenv("LANG");
+    spark_utf8 = loc && (strcasestr(loc, "UTF-8") || strcasestr(loc, "utf8"));
+    
+    hist_cores = calloc(num_cores, sizeof(series_t));
+    if (!hist_cores || series_alloc(&hist_cpu) != 0 || series_alloc(&hist_ram) != 0 ||
+        series_alloc(&hist_swap) != 0) return -1;
+    for (int i = 0; i < num_cores; i++) {
+        if (series_alloc(&hist_cores[i]) != 0) return -1;
+    }
+    return 0;
+}
+
+/* The rx/tx pair of an interface slot, or NULL */
+series_t *history_iface(int id) {
+    if (opt_history <= 0 || id < 0) return NULL;
+    if (id >= hist_net_slots) {
+        int slots = hist_net_slots ? hist_net_slots : 32;
+        while (slots <= id) slots *= 2;
+        series_t *nh = realloc(hist_net, 2 * (size_t)slots * sizeof(series_t));
+        if (!nh) return NULL;
+        memset(nh + 2 * hist_net_slots, 0, 2 * (size_t)(slots - hist_net_slots) * sizeof(series_t));
+        hist_net = nh;
+        hist_net_slots = slots;
+    }
+    series_t *h = &hist_net[2 * id];
+    if (!h[0].vals && (series_alloc(&h[0]) != 0 || series_alloc(&h[1]) != 0)) return NULL;
+    return h;
+}
+
+/* A slot that changes hands starts a new history */
+void history_forget_iface(int id) {
+    if (id < hist_net_slots && hist_net[2 * id].vals) {
+        series_reset(&hist_net[2 * id]);
+        series_reset(&hist_net[2 * id + 1]);
+    }
+}
+
+void history_push(const sample_t *s, int show_cpu, int show_mem, int show_net) {
+    if (opt_history <= 0) return;
+    if (show_cpu && col_due[COLL_CPU]) {
+        series_push(&hist_cpu, s->cpu_total);
+        for (int i = 0; i < num_cores; i++) series_push(&hist_cores[i], s->cpu_cores[i]);
+    }
+    if (show_mem && col_due[COLL_MEM]) {
+        series_push(&hist_ram, s->ram_pct);
+        series_push(&hist_swap, s->swap_pct);
+    }
+    if (show_net && col_due[COLL_NET] && s->net_ready) {
+        for (int i = 0; i < s->net_count; i++) {
+            const net_sample_t *n = &s->net[i];
+            series_t *h = n->valid ? history_iface(n->slot) : NULL;
+            if (!h) continue;
+            series_push(&h[0], n->rx_pct);
+            series_push(&h[1], n->tx_pct);
+        }
+    }
+}
+
+/* Prints a sparkline, and with stats the rolling figures, after a bar.
+ * A top of 0 scales the sparkline to the window's maximum. */
+void fb_history(const series_t *s, int width, double top, int stats) {
+    char spark[SPARK_WIDTH * 3 + 1];
+    if (opt_history <= 0 || !s || s->count == 0) return;
+    if (top <= 0) top = series_max(s) > 1.0 ? series_max(s) : 1.0;
+    series_spark(s, width, top, spark, sizeof(spark));
+    fb_printf(" %s%s%s", c_cyan(), spark, c_reset());
+    if (stats) {
+        fb_printf(" %smin %.1f avg %.1f max %.1f p95 %.1f%s", c_dim(),
+                  series_min(s), series_avg(s), series_max(s), series_p95(s), c_reset());
+    }
+}
+
+/* Turns the current and previous snapshots into percentages and rates */
+void compute_sample(sample_t *out, int show_cpu, int show_mem, int show_disks, int show_net) {
+    out->mono = snap->time;
+    out->wall = mono_to_wall(snap->time);
+    
+    if (show_cpu && col_due[COLL_CPU]) {
+        out->cpu_total = calculate_cpu_percent(&snap->total, &snap_prev->total);
+        for (int i = 0; i < num_cores; i++) {
+            cpu_stats_t curr, prev;
+            cpu_table_get(&snap->cores, i, &curr);
+            cpu_table_get(&snap_prev->cores, i, &prev);
+            out->cpu_cores[i] = calculate_cpu_percent(&curr, &prev);
+        }
+    }
+    
+    if (show_mem && col_due[COLL_MEM]) {
+        out->ram_total = (double)snap->mem_total * 1024;
+        out->ram_used = out->ram_total - ((double)snap->mem_available * 1024);
+        out->ram_pct = (out->ram_total > 0) ? (out->ram_used / out->ram_total) * 100.0 : 0.0;
+        
+        out->swap_total = (double)snap->swap_total * 1024;
+        out->swap_used = out->swap_total - ((double)snap->swap_free * 1024);
+        out->swap_pct = (out->swap_total > 0) ? (out->swap_used / out->swap_total) * 100.0 : 0.0;
+    }
+    
+    if (show_disks && col_due[COLL_DISK]) {
+        memcpy(out->disks, snap->disks, snap->disk_count * sizeof(disk_stats_t));
+        out->disk_count = snap->disk_count;
+    }
+    
+    if (show_disks && col_due[COLL_DISKIO]) {
+        double dt = snap->diskio_time - snap_prev->diskio_time;
+        double dt_ms = dt * 1000.0;
+        out->diskio_ready = (snap_prev->diskio_time != 0 && dt > 0);
+        out->diskio_count = 0;
+        
+        for (int c = 0; c < snap->diskio_count; c++) {
+            diskio_stats_t *curr = &snap->diskio[c];
+            diskio_sample_t *d = &out->diskio[out->diskio_count++];
+            memcpy(d->name, curr->name, sizeof(d->name));
+            d->r_iops = d->w_iops = d->r_bps = d->w_bps = 0;
+            d->util_pct = d->await_ms = d->queue = 0;
+            
+            diskio_stats_t *prev = out->diskio_ready ? find_prev_diskio(curr->name) : NULL;
+            d->valid = (prev != NULL);
+            if (!prev) continue;
+            
+            /* diskstats sectors are always 512 bytes regardless of the device */
+            double ios = (double)(curr->rd_ios - prev->rd_ios) + (curr->wr_ios - prev->wr_ios);
+            d->r_iops = (curr->rd_ios - prev->rd_ios) / dt;
+            d->w_iops = (curr->wr_ios - prev->wr_ios) / dt;
+            d->r_bps = (curr->rd_sectors - prev->rd_sectors) * 512.0 / dt;
+            d->w_bps = (curr->wr_sectors - prev->wr_sectors) * 512.0 / dt;
+            d->util_pct = (curr->io_ticks - prev->io_ticks) / dt_ms * 100.0;
+            if (d->util_pct > 100.0) d->util_pct = 100.0;
+            d->await_ms = ios > 0 ? ((double)(curr->rd_ticks - prev->rd_ticks) + (curr->wr_ticks - prev->wr_ticks)) / ios : 0;
+            d->queue = (curr->time_in_queue - prev->time_in_queue) / dt_ms;
+        }
+    }
+    
+    if (show_net && col_due[COLL_NET]) {
+        double dt = snap->net_time - snap_prev->net_time;
+        out->net_ready = (snap_prev->net_time != 0 && dt > 0);
+        out->net_count = 0;
+        if (snap->net_count > out->net_cap) {
+            net_sample_t *nn = realloc(out->net, snap->net_count * sizeof(net_sample_t));
+            if (!nn) return;
+            out->net = nn;
+            out->net_cap = snap->net_count;
+        }
+        
+        /* Every interface updates its slot, even when filtered out of the view */
+        iftab.gen++;
+        for (int c = 0; c < snap->net_count; c++) {
+            net_stats_t *curr = &snap->net[c];
+            int id = iftab_get(&iftab, curr->ifindex, curr->name);
+            if (id < 0) continue;
+            iface_slot_t *slot = &iftab.slots[id];
+            slot->seen = iftab.gen;
+            slot->sample_idx = -1;
+            
+            double slot_dt = snap->net_time - slot->time;
+            int have_prev = (slot->time > 0 && slot_dt > 0 &&
+                             curr->bytes_recv >= slot->rx && curr->bytes_sent >= slot->tx);
+            unsigned long long prev_rx = slot->rx, prev_tx = slot->tx;
+            if (slot->time == 0) history_forget_iface(id);
+            slot->rx = curr->bytes_recv;
+            slot->tx = curr->bytes_sent;
+            slot->time = snap->net_time;
+            
+            if (opt_net_iface && strcmp(opt_net_iface, curr->name) != 0) continue;
+            
+            slot->sample_idx = out->net_count;
+            net_sample_t *n = &out->net[out->net_count++];
+            memcpy(n->name, curr->name, sizeof(n->name));
+            n->slot = id;
+            n->rx_bps = n->tx_bps = n->rx_pct = n->tx_pct = 0;
+            n->valid = out->net_ready && have_prev;
+            if (!n->valid) continue;
+            
+            n->rx_bps = (curr->bytes_recv - prev_rx) / slot_dt;
+            n->tx_bps = (curr->bytes_sent - prev_tx) / slot_dt;
+            
+            double link_speed_bps = read_link_speed(slot) * 125000.0;
+            if (link_speed_bps <= 0) link_speed_bps = 100 * 1024 * 1024;
+            
+            n->rx_pct = (n->rx_bps / link_speed_bps) * 100.0;
+            n->tx_pct = (n->tx_bps / link_speed_bps) * 100.0;
+        }
+        iftab_sweep(&iftab);
+    }
+    
+    if (opt_psi) {
+        double dt = snap->psi_time - snap_prev->psi_time;
+        out->psi_ready = (snap_prev->psi_time != 0 && dt > 0);
+        for (int r = 0; r < PSI_COUNT; r++) {
+            const psi_stats_t *curr = &snap->psi[r], *prev = &snap_prev->psi[r];
+            psi_sample_t *o = &out->psi[r];
+            o->ok = curr->ok;
+            o->some_avg10 = curr->some_avg10;
+            o->full_avg10 = curr->full_avg10;
+            o->some_stall = o->full_stall = 0;
+            if (!out->psi_ready || !curr->ok || !prev->ok) continue;
+            if (curr->some_total >= prev->some_total) o->some_stall = (curr->some_total - prev->some_total) / (dt * 1e6) * 100.0;
+            if (curr->full_total >= prev->full_total) o->full_stall = (curr->full_total - prev->full_total) / (dt * 1e6) * 100.0;
+            if (o->some_stall > 100.0) o->some_stall = 100.0;
+            if (o->full_stall > 100.0) o->full_stall = 100.0;
+        }
+    }
+}
+
+void init_sampling(void) {
+    num_cores = replay_active ? (int)replay_opts.cores : sysconf(_SC_NPROCESSORS_ONLN);
+    cpu_table_init(&snapshots[0].cores, num_cores);
+    cpu_table_init(&snapshots[1].cores, num_cores);
+    cur_sample.cpu_cores = calloc(num_cores, sizeof(double));
+    
+    src_open(&src_stat, "/proc/stat", 0);
+    src_open(&src_meminfo, "/proc/meminfo", 0);
+    src_open(&src_netdev, "/proc/net/dev", 1);
+    /* Captures need /proc/net/dev; rtnetlink replies are not recorded */
+    if (!opt_record && !replay_active) nl_open();
+    if (opt_psi) {
+        for (int r = 0; r < PSI_COUNT; r++) src_open(&src_psi[r], psi_paths[r], 0);
+    }
+    if (opt_cgroup) cgroups_init();
+    src_open(&src_diskstats, "/proc/diskstats", 1);
+    if (opt_procs && procs_init() != 0) opt_procs = 0;
+    
+    sample_cpu(snap_prev);
+}
+
+/* Adaptive Sampling
+ * With --adaptive the tick runs at the --interval base period until any
+ * activity percentage (CPU, disk and link utilisation, PSI stall) reaches
+ * opt_adapt_threshold or any percentage moves faster than opt_adapt_slope
+ * points per second. RAM and swap fill levels only count by their slope:
+ * a node that sits at 80% memory is steady, not busy. It then samples every
+ * opt_fast_interval ms, and once nothing has triggered for opt_adapt_hold
+ * ms the period doubles each tick back to the base. Slopes are measured
+ * over at least ADAPT_SLOPE_WINDOW so that single fast ticks, which are
+ * quantized to the kernel's jiffy accounting, do not read as spikes. */
+#define ADAPT_METRICS 7
+#define ADAPT_FILL_LEVEL(i) ((i) == 2 || (i) == 3)    /* ram_pct, swap_pct */
+#define ADAPT_SLOPE_WINDOW 0.25
+#define DISPLAY_PERIOD_MS 250
+
+int opt_adaptive = 0;
+int opt_fast_interval = 20;
+double opt_adapt_threshold = 80.0;
+double opt_adapt_slope = 100.0;
+int opt_adapt_hold = 2000;
+double adapt_ref[ADAPT_METRICS];
+double adapt_ref_time = 0;
+double adapt_last_trigger = 0;
+unsigned long long adapt_fast_ticks = 0;
+
+/* Reduces a sample to the percentages that drive the rate */
+void adapt_metrics(const sample_t *s, double *m) {
+    m[0] = s->cpu_total;
+    m[1] = 0;
+    for (int i = 0; i < num_cores; i++) {
+        if (s->cpu_cores[i] > m[1]) m[1] = s->cpu_cores[i];
+    }
+    m[2] = s->ram_pct;
+    m[3] = s->swap_pct;
+    m[4] = 0;
+    for (int i = 0; s->diskio_ready && i < s->diskio_count; i++) {
+        if (s->diskio[i].valid && s->diskio[i].util_pct > m[4]) m[4] = s->diskio[i].util_pct;
+    }
+    m[5] = 0;
+    for (int i = 0; s->net_ready && i < s->net_count; i++) {
+        const net_sample_t *n = &s->net[i];
+        if (!n->valid) continue;
+        if (n->rx_pct > m[5]) m[5] = n->rx_pct;
+        if (n->tx_pct > m[5]) m[5] = n->tx_pct;
+    }
+    m[6] = 0;
+    for (int r = 0; s->psi_ready && r < PSI_COUNT; r++) {
+        if (s->psi[r].ok && s->psi[r].some_stall > m[6]) m[6] = s->psi[r].some_stall;
+    }
+}
+
+/* Picks the period of the next tick from the sample just taken */
+void adapt_update(const sample_t *s) {
+    double m[ADAPT_METRICS];
+    adapt_metrics(s, m);
+    
+    int hit = 0;
+    for (int i = 0; i < ADAPT_METRICS; i++) {
+        if (!ADAPT_FILL_LEVEL(i) && m[i] >= opt_adapt_threshold) hit = 1;
+    }
+    double dt = s->mono - adapt_ref_time;
+    if (adapt_ref_time == 0 || dt >= ADAPT_SLOPE_WINDOW) {
+        for (int i = 0; adapt_ref_time > 0 && i < ADAPT_METRICS; i++) {
+            if (fabs(m[i] - adapt_ref[i]) / dt >= opt_adapt_slope) hit = 1;
+        }
+        memcpy(adapt_ref, m, sizeof(adapt_ref));
+        adapt_ref_time = s->mono;
+    }
+    
+    long long fast_ns = (long long)opt_fast_interval * 1000000LL;
+    long long base_ns = (long long)sched_base_ms * 1000000LL;
+    long long next_ns = tick_period_ns;
+    if (hit) {
+        adapt_last_trigger = s->mono;
+        next_ns = fast_ns;
+    } else if ((s->mono - adapt_last_trigger) * 1000.0 >= opt_adapt_hold) {
+        next_ns = tick_period_ns * 2 < base_ns ? tick_period_ns * 2 : base_ns;
+    }
+    if (next_ns < base_ns) adapt_fast_ticks++;
+    if (next_ns != tick_period_ns) sched_set_period(next_ns);
+}
+
+void get_cpu_info(const sample_t *s, int bar_width) {
+    char buf[256];
+    
+    if (opt_cpulist) {
+        for (int i = 0; i < num_cores; i++) {
+            draw_bar_ascii(s->cpu_cores[i], 100, bar_width, buf, sizeof(buf));
+            fb_printf("CPU %2d: %s", i, buf);
+            fb_history(hist_cores ? &hist_cores[i] : NULL, SPARK_WIDTH, 100, 1);
+            fb_printf("\n");
+        }
+    } else {
+        draw_bar_ascii(s->cpu_total, 100, bar_width, buf, sizeof(buf));
+        fb_printf("%sCPU%s (%d cores): %s", c_blue(), c_reset(), num_cores, buf);
+        fb_history(&hist_cpu, SPARK_WIDTH, 100, 1);
+        fb_printf("\n");
+        
+        int cores_per_row = 3;
+        for (int i = 0; i < num_cores; i += cores_per_row) {
+            for (int j = i; j < i + cores_per_row && j < num_cores; j++) {
+                draw_bar_ascii(s->cpu_cores[j], 100, bar_width, buf, sizeof(buf));
+                fb_printf("%s#%2d:%s%s", c_white(), j, c_reset(), buf);
+                fb_history(hist_cores ? &hist_cores[j] : NULL, SPARK_CORE_WIDTH, 100, 0);
+                fb_printf("  ");
+            }
+            fb_printf("\n");
+        }
+    }
+}
+
+void get_memory_info(const sample_t *s, int bar_width) {
+    char bar[256], b1[32], b2[32];
+    
+    draw_bar_ascii(s->ram_used, s->ram_total, bar_width, bar, sizeof(bar));
+    format_bytes(s->ram_used, b1, sizeof(b1));
+    format_bytes(s->ram_total, b2, sizeof(b2));
+    fb_printf("RAM:    %s %s%s/%s%s", bar, c_white(), b1, b2, c_reset());
+    fb_history(&hist_ram, SPARK_WIDTH, 100, 1);
+    fb_printf("\n");
+    
+    draw_bar_ascii(s->swap_used, s->swap_total, bar_width, bar, sizeof(bar));
+    format_bytes(s->swap_used, b1, sizeof(b1));
+    format_bytes(s->swap_total, b2, sizeof(b2));
+    fb_printf("SWAP:   %s %s%s/%s%s", bar, c_white(), b1, b2, c_reset());
+    fb_history(&hist_swap, SPARK_WIDTH, 100, 1);
+    fb_printf("\n");
+}
+
+void get_disk_info(const sample_t *s, int bar_width) {
+    char bar[256], b1[32], b2[32];
+    
+    for (int i = 0; i < s->disk_count; i++) {
+        const disk_stats_t *d = &s->disks[i];
+        if (!d->ok) {
+            if (d->stale) {
+                fb_printf("%s%s%s (%s): %sno answer from statvfs%s\n",
+                   c_cyan(), d->fsname, c_reset(), d->dir, c_yellow(), c_reset());
+            }
+            continue;
+        }
+        
+        draw_bar_ascii((double)d->used, (double)d->total, bar_width, bar, sizeof(bar));
+        format_bytes((double)d->used, b1, sizeof(b1));
+        format_bytes((double)d->total, b2, sizeof(b2));
+        
+        fb_printf("%s%s%s (%s): %s %s%s/%s%s", 
+           c_cyan(), d->fsname, c_reset(), d->dir,
+           bar, c_white(), b1, b2, c_reset());
+        if (d->stale) fb_printf(" %sstale%s", c_yellow(), c_reset());
+        fb_printf("\n");
+    }
+    
+    if (!s->diskio_ready) return;
+    for (int i = 0; i < s->diskio_count; i++) {
+        const diskio_sample_t *d = &s->diskio[i];
+        if (!d->valid) continue;
+        
+        draw_bar_ascii(d->util_pct, 100, bar_width, bar, sizeof(bar));
+        format_bytes(d->r_bps, b1, sizeof(b1));
+        format_bytes(d->w_bps, b2, sizeof(b2));
+        fb_printf("%sIO %-8s%s %s %sR %s/s W %s/s%s\n",
+           c_cyan(), d->name, c_reset(), bar, c_white(), b1, b2, c_reset());
+        fb_printf("            %s%.0f r/s  %.0f w/s  await %.1f ms  queue %.2f%s\n",
+           c_dim(), d->r_iops, d->w_iops, d->await_ms, d->queue, c_reset());
+    }
+}
+
+void get_net_info(const sample_t *s, int bar_width) {
+    char bar[256], b1[32];
+    
+    if (!s->net_ready) {
+        fb_printf("%sNET%s:  Waiting for first sample...\n", c_magenta(), c_reset());
+        return;
+    }
+    
+    for (int i = 0; i < s->net_count; i++) {
+        const net_sample_t *n = &s->net[i];
+        if (!n->valid) continue;
+        /* Link rates are mostly small fractions; scale to the window */
+        series_t *h = n->slot < hist_net_slots && hist_net[2 * n->slot].vals ? &hist_net[2 * n->slot] : NULL;
+        
+        draw_bar_ascii(n->rx_pct, 100, bar_width, bar, sizeof(bar));
+        format_bytes(n->rx_bps, b1, sizeof(b1));
+        fb_printf("DN:     %s %s%s/s%s", bar, c_white(), b1, c_reset());
+        fb_history(h, SPARK_WIDTH, 0, 1);
+        fb_printf("\n");
+        
+        draw_bar_ascii(n->tx_pct, 100, bar_width, bar, sizeof(bar));
+        format_bytes(n->tx_bps, b1, sizeof(b1));
+        fb_printf("UP:     %s %s%s/s%s", bar, c_white(), b1, c_reset());
+        fb_history(h ? &h[1] : NULL, SPARK_WIDTH, 0, 1);
+        fb_printf("\n");
+    }
+}
+
+void get_psi_info(const sample_t *s, int bar_width) {
+    char bar[256];
+    
+    for (int r = 0; r < PSI_COUNT; r++) {
+        const psi_sample_t *p = &s->psi[r];
+        if (!p->ok) {
+            fb_printf("%sPSI %-6s%s  unavailable\n", c_magenta(), psi_names[r], c_reset());
+            continue;
+        }
+        draw_bar_ascii(p->some_stall, 100, bar_width, bar, sizeof(bar));
+        fb_printf("%sPSI %-6s%s some: %s %savg10 %.2f%s\n", c_magenta(), psi_names[r], c_reset(),
+                  bar, c_dim(), p->some_avg10, c_reset());
+        draw_bar_ascii(p->full_stall, 100, bar_width, bar, sizeof(bar));
+        fb_printf("           full: %s %savg10 %.2f%s\n", bar, c_dim(), p->full_avg10, c_reset());
+    }
+}
+
+/* Paths longer than width keep their tail, which names the leaf cgroup */
+void get_cgroup_info(void) {
+    char b1[32], b2[32], b3[32], label[48];
+    const int width = 40;
+    
+    if (!cgroup_root[0] || cgroup_count == 0) {
+        fb_printf("%sCGROUPS%s: no cgroup v2 hierarchy at '%s'\n", c_magenta(), c_reset(), opt_cgroup);
+        return;
+    }
+    
+    int n = 0;
+    for (int i = 0; i < cgroup_count; i++) {
+        if (cgroups[i].valid && !cgroups[i].gone) cgroup_order[n++] = i;
+    }
+    qsort(cgroup_order, n, sizeof(int), cgroup_cmp_cpu);
+    
+    fb_printf("%sCGROUPS%s: %d under /%s %s(tree rescanned every %.0fs)%s\n", c_magenta(), c_reset(),
+              cgroup_count, cgroup_base, c_dim(), CGROUP_RESCAN_SEC, c_reset());
+    fb_printf("%s%-*s %7s %9s %11s %11s%s\n", c_white(), width, "CGROUP", "CPU%", "MEM", "IO READ", "IO WRITE", c_reset());
+    for (int k = 0; k < n && k < CGROUP_ROWS; k++) {
+        const cgroup_t *cg = &cgroups[cgroup_order[k]];
+        const char *path = cg->path[0] ? cg->path : "/";
+        size_t len = strlen(path);
+        if ((int)len > width) snprintf(label, sizeof(label), "...%s", path + len - (width - 3));
+        else snprintf(label, sizeof(label), "%s", path);
+        
+        if (cg->has_mem) format_bytes(cg->mem_bytes, b1, sizeof(b1));
+        else snprintf(b1, sizeof(b1), "-");
+        format_bytes(cg->io_rbps, b2, sizeof(b2));
+        format_bytes(cg->io_wbps, b3, sizeof(b3));
+        fb_printf("%s%-*s%s %s%6.1f%%%s %9s %9s/s %9s/s\n", c_cyan(), width, label, c_reset(),
+                  get_color_for_percentage(cg->cpu_pct), cg->cpu_pct, c_reset(), b1, b2, b3);
+    }
+}
+
+void get_procs_info(void) {
+    static const char *keys[] = { "CPU", "RSS", "I/O" };
+    char b1[32], b2[32];
+    
+    fb_printf("%sPROCESSES%s: %zu tracked, top %d by %s %s(scan %.2f ms)%s\n",
+              c_magenta(), c_reset(), procs.count, procs_top_count,
+              keys[opt_procs_sort], c_dim(), procs_scan_ms, c_reset());
+    fb_printf("%s%7s  %-15s %7s %9s %11s%s\n", c_white(), "PID", "NAME", "CPU%", "RSS", "I/O", c_reset());
+    for (int i = 0; i < procs_top_count; i++) {
+        const proc_entry_t *e = &procs.slots[procs_top[i]];
+        format_bytes(e->rss_bytes, b1, sizeof(b1));
+        format_bytes(e->io_bps, b2, sizeof(b2));
+        fb_printf("%7d  %s%-15s%s %s%6.1f%%%s %9s %9s/s\n", e->pid, c_cyan(), e->comm, c_reset(),
+                  get_color_for_percentage(e->cpu_pct), e->cpu_pct, c_reset(), b1, b2);
+    }
+}
+
+/* Logging Functions */
+
+/* The log schema is fixed from the first sample: one column per metric,
+ * with disks and interfaces matched by name on later ticks so columns never
+ * shift when devices come and go. Every sink (CSV, ring buffer) uses it. */
+typedef enum {
+    COL_PERCENT,
+    COL_BYTES,
+    COL_RATE,
+    COL_FLAG
+} col_kind_t;
+
+typedef struct {
+    char name[96];
+    col_kind_t kind;
+} log_col_t;
+
+log_col_t *log_cols = NULL;
+int log_col_count = 0;
+int log_show_cpu = 0, log_show_mem = 0, log_show_disks = 0, log_show_net = 0, log_show_psi = 0;
+int log_show_self = 0;
+int log_stages[STAGE_COUNT];
+int log_stage_count = 0;
+
+char log_disks[MAX_DISKS][64];
+int log_disk_count = 0;
+char (*log_ifaces)[32] = NULL;
+int log_iface_count = 0;
+char log_diskios[MAX_DISKIO][32];
+int log_diskio_count = 0;
+
+void add_log_col(const char *name, col_kind_t kind) {
+    log_col_t *c = &log_cols[log_col_count++];
+    snprintf(c->name, sizeof(c->name), "%s", name);
+    c->kind = kind;
+}
+
+void build_log_schema(const sample_t *s, int show_cpu, int show_mem, int show_disks, int show_net) {
+    char name[96];
+    int max_cols = 1 + num_cores + 6 + 4 * MAX_DISKS + 7 * MAX_DISKIO + 2 * s->net_count + 4 * PSI_COUNT + 2 + 2 * STAGE_COUNT;
+    log_cols = calloc(max_cols, sizeof(log_col_t));
+    log_ifaces = calloc(s->net_count + 1, sizeof(*log_ifaces));
+    if (!log_cols || !log_ifaces) return;
+    log_show_cpu = show_cpu;
+    log_show_mem = show_mem;
+    log_show_disks = show_disks;
+    log_show_net = show_net;
+    log_show_psi = opt_psi;
+    log_show_self = opt_selfstat;
+    
+    if (show_cpu) {
+        add_log_col("CPU_Total_Percent", COL_PERCENT);
+        for (int i = 0; i < num_cores; i++) {
+            snprintf(name, sizeof(name), "CPU_Core_%d_Percent", i);
+            add_log_col(name, COL_PERCENT);
+        }
+    }
+    
+    if (show_mem) {
+        add_log_col("RAM_Used_Bytes", COL_BYTES);
+        add_log_col("RAM_Total_Bytes", COL_BYTES);
+        add_log_col("RAM_Percent", COL_PERCENT);
+        add_log_col("Swap_Used_Bytes", COL_BYTES);
+        add_log_col("Swap_Total_Bytes", COL_BYTES);
+        add_log_col("Swap_Percent", COL_PERCENT);
+    }
+    
+    if (show_disks) {
+        for (int i = 0; i < s->disk_count; i++) {
+            const char *fs = s->disks[i].fsname;
+            memcpy(log_disks[log_disk_count++], fs, sizeof(log_disks[0]));
+            snprintf(name, sizeof(name), "Disk_%.64s_Used_Bytes", fs);
+            add_log_col(name, COL_BYTES);
+            snprintf(name, sizeof(name), "Disk_%.64s_Total_Bytes", fs);
+            add_log_col(name, COL_BYTES);
+            snprintf(name, sizeof(name), "Disk_%.64s_Percent", fs);
+            add_log_col(name, COL_PERCENT);
+            snprintf(name, sizeof(name), "Disk_%.64s_Stale", fs);
+            add_log_col(name, COL_FLAG);
+        }
+        for (int i = 0; i < s->diskio_count; i++) {
+            const char *dev = s->diskio[i].name;
+            memcpy(log_diskios[log_diskio_count++], dev, sizeof(log_diskios[0]));
+            snprintf(name, sizeof(name), "DiskIO_%.32s_Read_IOPS", dev);
+            add_log_col(name, COL_RATE);
+            snprintf(name, sizeof(name), "DiskIO_%.32s_Write_IOPS", dev);
+            add_log_col(name, COL_RATE);
+            snprintf(name, sizeof(name), "DiskIO_%.32s_Read_Bps", dev);
+            add_log_col(name, COL_RATE);
+            snprintf(name, sizeof(name), "DiskIO_%.32s_Write_Bps", dev);
+            add_log_col(name, COL_RATE);
+            snprintf(name, sizeof(name), "DiskIO_%.32s_Util_Percent", dev);
+            add_log_col(name, COL_PERCENT);
+            snprintf(name, sizeof(name), "DiskIO_%.32s_Await_ms", dev);
+            add_log_col(name, COL_RATE);
+            snprintf(name, sizeof(name), "DiskIO_%.32s_Queue", dev);
+            add_log_col(name, COL_RATE);
+        }
+    }
+    
+    if (show_net) {
+        for (int i = 0; i < s->net_count; i++) {
+            const char *ifname = s->net[i].name;
+            memcpy(log_ifaces[log_iface_count++], ifname, sizeof(log_ifaces[0]));
+            snprintf(name, sizeof(name), "Net_%.32s_RX_Bps", ifname);
+            add_log_col(name, COL_RATE);
+            snprintf(name, sizeof(name), "Net_%.32s_TX_Bps", ifname);
+            add_log_col(name, COL_RATE);
+        }
+    }
+    
+    if (opt_psi) {
+        for (int r = 0; r < PSI_COUNT; r++) {
+            snprintf(name, sizeof(name), "PSI_%s_Some_Avg10", psi_names[r]);
+            add_log_col(name, COL_PERCENT);
+            snprintf(name, sizeof(name), "PSI_%s_Full_Avg10", psi_names[r]);
+            add_log_col(name, COL_PERCENT);
+            snprintf(name, sizeof(name), "PSI_%s_Some_Stall_Percent", psi_names[r]);
+            add_log_col(name, COL_PERCENT);
+            snprintf(name, sizeof(name), "PSI_%s_Full_Stall_Percent", psi_names[r]);
+            add_log_col(name, COL_PERCENT);
+        }
+    }
+    
+    if (opt_selfstat) {
+        int on[STAGE_COUNT] = { show_cpu, show_mem, show_disks, show_disks, show_net, opt_procs > 0,
+                                opt_psi, opt_cgroup != NULL, 1, 1, !opt_daemon, opt_listen != NULL };
+        add_log_col("Self_CPU_Percent", COL_PERCENT);
+        add_log_col("Self_MaxRSS_Bytes", COL_BYTES);
+        for (int st = 0; st < STAGE_COUNT; st++) {
+            if (!on[st]) continue;
+            log_stages[log_stage_count++] = st;
+            snprintf(name, sizeof(name), "Self_%s_P50_us", stage_names[st]);
+            add_log_col(name, COL_RATE);
+            snprintf(name, sizeof(name), "Self_%s_P99_us", stage_names[st]);
+            add_log_col(name, COL_RATE);
+        }
+    }
+}
+
+/* Flattens a sample into one value per schema column */
+void sample_to_row(const sample_t *s, double *row) {
+    int k = 0;
+    
+    if (log_show_cpu) {
+        row[k++] = s->cpu_total;
+        for (int i = 0; i < num_cores; i++) row[k++] = s->cpu_cores[i];
+    }
+    
+    if (log_show_mem) {
+        row[k++] = s->ram_used;
+        row[k++] = s->ram_total;
+        row[k++] = s->ram_pct;
+        row[k++] = s->swap_used;
+        row[k++] = s->swap_total;
+        row[k++] = s->swap_pct;
+    }
+    
+    if (log_show_disks) {
+        for (int c = 0; c < log_disk_count; c++) {
+            const disk_stats_t *d = NULL;
+            for (int i = 0; i < s->disk_count; i++) {
+                if (strcmp(s->disks[i].fsname, log_disks[c]) == 0) { d = &s->disks[i]; break; }
             }
-            fclose(f);
-            
-            if (mem_available == 0) mem_available = 0;
-            
-            double total_bytes = (double)mem_total * 1024;
-            double used_bytes = total_bytes - ((double)mem_available * 1024);
-            double pct = (total_bytes > 0) ? (used_bytes / total_bytes) * 100.0 : 0.0;
-            
-            double sw_total = (double)swap_total * 1024;
-            double sw_used = sw_total - ((double)swap_free * 1024);
-            double sw_pct = (sw_total > 0) ? (sw_used / sw_total) * 100.0 : 0.0;
-            
-            fprintf(log_fp, ",%.0f,%.0f,%.2f,%.0f,%.0f,%.2f", used_bytes, total_bytes, pct, sw_used, sw_total, sw_pct);
+            if (d && d->ok) {
+                row[k++] = (double)d->used;
+                row[k++] = (double)d->total;
+                row[k++] = (d->total > 0) ? ((double)d->used / d->total) * 100.0 : 0.0;
+            } else {
+                row[k++] = 0;
+                row[k++] = 0;
+                row[k++] = 0;
+            }
+            row[k++] = d ? d->stale : 0;
+        }
+        for (int c = 0; c < log_diskio_count; c++) {
+            const diskio_sample_t *d = NULL;
+            for (int i = 0; i < s->diskio_count; i++) {
+                if (strcmp(s->diskio[i].name, log_diskios[c]) == 0) { d = &s->diskio[i]; break; }
+            }
+            int ok = d && d->valid;
+            row[k++] = ok ? d->r_iops : 0;
+            row[k++] = ok ? d->w_iops : 0;
+            row[k++] = ok ? d->r_bps : 0;
+            row[k++] = ok ? d->w_bps : 0;
+            row[k++] = ok ? d->util_pct : 0;
+            row[k++] = ok ? d->await_ms : 0;
+            row[k++] = ok ? d->queue : 0;
+        }
+    }
+    
+    if (log_show_net) {
+        for (int c = 0; c < log_iface_count; c++) {
+            const net_sample_t *n = NULL;
+            int id = iftab_lookup(&iftab, 0, log_ifaces[c]);
+            int idx = id >= 0 ? iftab.slots[id].sample_idx : -1;
+            if (idx >= 0 && idx < s->net_count && strcmp(s->net[idx].name, log_ifaces[c]) == 0) n = &s->net[idx];
+            row[k++] = (n && n->valid) ? n->rx_bps : 0;
+            row[k++] = (n && n->valid) ? n->tx_bps : 0;
+        }
+    }
+    
+    if (log_show_psi) {
+        for (int r = 0; r < PSI_COUNT; r++) {
+            const psi_sample_t *p = &s->psi[r];
+            row[k++] = p->some_avg10;
+            row[k++] = p->full_avg10;
+            row[k++] = p->some_stall;
+            row[k++] = p->full_stall;
+        }
+    }
+    
+    if (log_show_self) {
+        row[k++] = self_cpu_pct;
+        row[k++] = self_maxrss;
+        for (int i = 0; i < log_stage_count; i++) {
+            row[k++] = self_p50[log_stages[i]];
+            row[k++] = self_p99[log_stages[i]];
+        }
+    }
+}
+
+void csv_encode_header(strbuf_t *sb) {
+    sb_append(sb, "Timestamp", 9);
+    for (int i = 0; i < log_col_count; i++) sb_printf(sb, ",%s", log_cols[i].name);
+    sb_append(sb, "\n", 1);
+}
+
+void csv_encode_row(strbuf_t *sb, double wall, const double *row) {
+    char timestamp[40];
+    format_timestamp(wall, timestamp, sizeof(timestamp));
+    sb_append(sb, timestamp, strlen(timestamp));
+    for (int i = 0; i < log_col_count; i++) {
+        if (log_cols[i].kind == COL_BYTES || log_cols[i].kind == COL_FLAG) sb_printf(sb, ",%.0f", row[i]);
+        else sb_printf(sb, ",%.2f", row[i]);
+    }
+    sb_append(sb, "\n", 1);
+}
+
+/* Binary Log Format
+ *
+ *   "UMONLOG\0"  u16 version  u16 reserved  u32 column count
+ *   per column:  u8 kind  u8 name length  name bytes
+ *   records:     0xA5 tag, varint timestamp delta (ms), one varint per column
+ *
+ * Values are stored as fixed-point integers at the precision the CSV log
+ * prints (1/100 for percentages and rates, whole bytes and flags),
+ * zigzag-encoded as the difference from the previous record. Fixed-width
+ * little-endian header fields; a truncated trailing record is ignored by
+ * --dump. Version 2 added the flag column kind; version 1 logs still read. */
+#define BINLOG_MAGIC "UMONLOG"
+#define BINLOG_VERSION 2
+#define BINLOG_RECORD 0xA5
+
+enum { LOG_FORMAT_CSV, LOG_FORMAT_BIN };
+int opt_log_format = LOG_FORMAT_CSV;
+
+long long *bin_prev = NULL;
+long long bin_prev_ms = 0;
+
+long long col_scale(col_kind_t kind) {
+    return kind == COL_BYTES || kind == COL_FLAG ? 1 : 100;
+}
+
+void put_u16(strbuf_t *sb, unsigned v) {
+    unsigned char b[2] = { (unsigned char)(v & 0xff), (unsigned char)(v >> 8) };
+    sb_append(sb, (const char *)b, 2);
+}
+
+void put_u32(strbuf_t *sb, uint32_t v) {
+    unsigned char b[4] = { (unsigned char)v, (unsigned char)(v >> 8), (unsigned char)(v >> 16), (unsigned char)(v >> 24) };
+    sb_append(sb, (const char *)b, 4);
+}
+
+void put_varint(strbuf_t *sb, long long sv) {
+    uint64_t v = ((uint64_t)sv << 1) ^ (uint64_t)(sv >> 63);
+    unsigned char b[10];
+    int n = 0;
+    while (v >= 0x80) {
+        b[n++] = (unsigned char)(v | 0x80);
+        v >>= 7;
+    }
+    b[n++] = (unsigned char)v;
+    sb_append(sb, (const char *)b, n);
+}
+
+void bin_reset(void) {
+    if (bin_prev) memset(bin_prev, 0, log_col_count * sizeof(long long));
+    bin_prev_ms = 0;
+}
+
+/* Writes the header and restarts delta coding, so every file (or rotated
+ * segment) starting with a header decodes on its own. */
+void bin_encode_header(strbuf_t *sb) {
+    sb_append(sb, BINLOG_MAGIC, sizeof(BINLOG_MAGIC));
+    put_u16(sb, BINLOG_VERSION);
+    put_u16(sb, 0);
+    put_u32(sb, (uint32_t)log_col_count);
+    for (int i = 0; i < log_col_count; i++) {
+        size_t len = strlen(log_cols[i].name);
+        unsigned char meta[2] = { (unsigned char)log_cols[i].kind, (unsigned char)len };
+        sb_append(sb, (const char *)meta, 2);
+        sb_append(sb, log_cols[i].name, len);
+    }
+    bin_reset();
+}
+
+void bin_encode_row(strbuf_t *sb, double wall, const double *row) {
+    long long ms = llround(wall * 1000.0);
+    char tag = (char)BINLOG_RECORD;
+    sb_append(sb, &tag, 1);
+    put_varint(sb, ms - bin_prev_ms);
+    bin_prev_ms = ms;
+    for (int i = 0; i < log_col_count; i++) {
+        long long q = llround(row[i] * col_scale(log_cols[i].kind));
+        put_varint(sb, q - bin_prev[i]);
+        bin_prev[i] = q;
+    }
+}
+
+int get_varint(FILE *fp, long long *out) {
+    uint64_t v = 0;
+    int shift = 0, c;
+    do {
+        if ((c = getc_unlocked(fp)) == EOF || shift > 63) return -1;
+        v |= (uint64_t)(c & 0x7f) << shift;
+        shift += 7;
+    } while (c & 0x80);
+    *out = (long long)(v >> 1) ^ -(long long)(v & 1);
+    return 0;
+}
+
+/* Converts a binary log back to the CSV layout on stdout. Headers may
+ * repeat inside the stream and reset the decoder. */
+int dump_binary_log(const char *path) {
+    FILE *fp = fopen(path, "rb");
+    if (!fp) {
+        perror("Failed to open binary log");
+        return 1;
+    }
+    
+    strbuf_t out = { 0 };
+    double *row = NULL;
+    int c, rc = 0;
+    
+    while ((c = getc_unlocked(fp)) != EOF) {
+        if (c == BINLOG_MAGIC[0]) {
+            unsigned char hdr[sizeof(BINLOG_MAGIC) - 1 + 8];
+            if (fread(hdr, 1, sizeof(hdr), fp) != sizeof(hdr) ||
+                memcmp(hdr, BINLOG_MAGIC + 1, sizeof(BINLOG_MAGIC) - 1) != 0) {
+                fprintf(stderr, "%s: bad header\n", path);
+                rc = 1;
+                break;
+            }
+            const unsigned char *h = hdr + sizeof(BINLOG_MAGIC) - 1;
+            unsigned version = h[0] | (h[1] << 8);
+            uint32_t ncols = h[4] | (h[5] << 8) | ((uint32_t)h[6] << 16) | ((uint32_t)h[7] << 24);
+            if (version < 1 || version > BINLOG_VERSION || ncols > 1000000) {
+                fprintf(stderr, "%s: unsupported version %u\n", path, version);
+                rc = 1;
+                break;
+            }
+            free(log_cols);
+            free(bin_prev);
+            free(row);
+            log_cols = calloc(ncols ? ncols : 1, sizeof(log_col_t));
+            bin_prev = calloc(ncols ? ncols : 1, sizeof(long long));
+            row = calloc(ncols ? ncols : 1, sizeof(double));
+            log_col_count = (int)ncols;
+            for (uint32_t i = 0; i < ncols; i++) {
+                unsigned char meta[2];
+                char name[256];
+                if (fread(meta, 1, 2, fp) != 2 || fread(name, 1, meta[1], fp) != meta[1]) {
+                    rc = 1;
+                    break;
+                }
+                name[meta[1]] = '\0';
+                snprintf(log_cols[i].name, sizeof(log_cols[i].name), "%.95s", name);
+                log_cols[i].kind = (col_kind_t)meta[0];
+            }
+            if (rc) break;
+            bin_prev_ms = 0;
+            out.len = 0;
+            csv_encode_header(&out);
+            fwrite(out.buf, 1, out.len, stdout);
+            continue;
+        }
+        if (c != BINLOG_RECORD || !log_cols) {
+            fprintf(stderr, "%s: not a umon binary log\n", path);
+            rc = 1;
+            break;
+        }
+        
+        long long d;
+        if (get_varint(fp, &d) != 0) break;
+        bin_prev_ms += d;
+        int i;
+        for (i = 0; i < log_col_count; i++) {
+            if (get_varint(fp, &d) != 0) break;
+            bin_prev[i] += d;
+            row[i] = (double)bin_prev[i] / col_scale(log_cols[i].kind);
+        }
+        if (i < log_col_count) break;
+        out.len = 0;
+        csv_encode_row(&out, bin_prev_ms / 1000.0, row);
+        fwrite(out.buf, 1, out.len, stdout);
+    }
+    
+    fclose(fp);
+    free(out.buf);
+    free(row);
+    return rc;
+}
+
+/* Asynchronous Log Writer
+ * The sampling loop hands encoded rows to a writer thread through a
+ * single-producer/single-consumer byte ring. Neither side takes a lock: the
+ * producer only advances head and the consumer only advances tail. The
+ * writer batches everything queued into one write() once the batch is large
+ * or the flush interval has passed. Rows that do not fit in the ring are
+ * dropped and counted instead of stalling the sampler on a slow disk. */
+#define LOGW_BATCH_BYTES (256 * 1024)
+
+typedef struct {
+    char *buf;
+    size_t cap;
+    size_t head;
+    size_t tail;
+} spsc_ring_t;
+
+int opt_log_flush_ms = 1000;
+int opt_log_queue_kb = 1024;
+
+spsc_ring_t logw_ring;
+pthread_t logw_thread;
+int logw_running = 0;
+int logw_stop = 0;
+strbuf_t logw_header;
+unsigned long long logw_rows_queued = 0;
+unsigned long long logw_rows_written = 0;
+unsigned long long logw_rows_dropped = 0;
+unsigned long long logw_write_errors = 0;
+
+int spsc_init(spsc_ring_t *q, size_t min_cap) {
+    size_t cap = 4096;
+    while (cap < min_cap) cap <<= 1;
+    q->buf = malloc(cap);
+    if (!q->buf) return -1;
+    q->cap = cap;
+    q->head = q->tail = 0;
+    return 0;
+}
+
+void spsc_copy_in(spsc_ring_t *q, size_t pos, const void *data, size_t len) {
+    size_t off = pos & (q->cap - 1);
+    size_t first = q->cap - off < len ? q->cap - off : len;
+    memcpy(q->buf + off, data, first);
+    memcpy(q->buf, (const char *)data + first, len - first);
+}
+
+void spsc_copy_out(spsc_ring_t *q, size_t pos, void *data, size_t len) {
+    size_t off = pos & (q->cap - 1);
+    size_t first = q->cap - off < len ? q->cap - off : len;
+    memcpy(data, q->buf + off, first);
+    memcpy((char *)data + first, q->buf, len - first);
+}
+
+/* Producer side: queues one length-prefixed record, or returns -1 if full */
+int spsc_push(spsc_ring_t *q, const char *data, uint32_t len) {
+    size_t head = q->head;
+    size_t tail = __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+    if (q->cap - (head - tail) < (size_t)len + sizeof(len)) return -1;
+    spsc_copy_in(q, head, &len, sizeof(len));
+    spsc_copy_in(q, head + sizeof(len), data, len);
+    __atomic_store_n(&q->head, head + sizeof(len) + len, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/* Consumer side: appends the next record to out and stores its length.
+ * Returns 0 when the queue is empty. A zero-length record marks a rotation. */
+int spsc_pop(spsc_ring_t *q, strbuf_t *out, uint32_t *len_out) {
+    size_t head = __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+    size_t tail = q->tail;
+    if (tail == head) return 0;
+    uint32_t len;
+    spsc_copy_out(q, tail, &len, sizeof(len));
+    if (sb_reserve(out, len) != 0) return 0;
+    spsc_copy_out(q, tail + sizeof(len), out->buf + out->len, len);
+    out->len += len;
+    *len_out = len;
+    __atomic_store_n(&q->tail, tail + sizeof(len) + len, __ATOMIC_RELEASE);
+    return 1;
+}
+
+int write_all(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+void rotate_log_file(void);
+
+void *logw_main(void *arg) {
+    (void)arg;
+    strbuf_t batch = { 0 };
+    unsigned long long batch_rows = 0;
+    double last_write = get_time_sec();
+    double flush_s = opt_log_flush_ms / 1000.0;
+    long sleep_ms = opt_log_flush_ms / 4;
+    if (sleep_ms < 10) sleep_ms = 10;
+    if (sleep_ms > 250) sleep_ms = 250;
+    
+    if (write_all(log_fd, logw_header.buf, logw_header.len) != 0) logw_write_errors++;
+    
+    for (;;) {
+        int stopping = __atomic_load_n(&logw_stop, __ATOMIC_ACQUIRE);
+        int rotate = 0;
+        uint32_t len;
+        while (batch.len < LOGW_BATCH_BYTES && spsc_pop(&logw_ring, &batch, &len)) {
+            if (len == 0) {
+                rotate = 1;
+                break;
+            }
+            batch_rows++;
+        }
+        
+        double now = get_time_sec();
+        if (batch.len > 0 && (rotate || stopping || batch.len >= LOGW_BATCH_BYTES || now - last_write >= flush_s)) {
+            if (write_all(log_fd, batch.buf, batch.len) != 0) logw_write_errors++;
+            __atomic_add_fetch(&logw_rows_written, batch_rows, __ATOMIC_RELAXED);
+            batch.len = 0;
+            batch_rows = 0;
+            last_write = now;
+        }
+        if (rotate) {
+            rotate_log_file();
+            continue;
+        }
+        if (stopping && batch.len == 0 && logw_ring.tail == __atomic_load_n(&logw_ring.head, __ATOMIC_ACQUIRE)) break;
+        if (batch.len >= LOGW_BATCH_BYTES) continue;
+        
+        struct timespec ts = { 0, sleep_ms * 1000000L };
+        nanosleep(&ts, NULL);
+    }
+    free(batch.buf);
+    return NULL;
+}
+
+/* Starts the writer once the header is known; it is written first */
+int logw_start(const char *header, size_t len) {
+    if (spsc_init(&logw_ring, (size_t)opt_log_queue_kb * 1024) != 0) return -1;
+    sb_append(&logw_header, header, len);
+    if (pthread_create(&logw_thread, NULL, logw_main, NULL) != 0) return -1;
+    logw_running = 1;
+    return 0;
+}
+
+void logw_submit(const char *data, size_t len) {
+    if (!logw_running) return;
+    if (spsc_push(&logw_ring, data, (uint32_t)len) == 0) logw_rows_queued++;
+    else logw_rows_dropped++;
+}
+
+/* Queues a rotation marker; the writer switches segments when it gets there */
+int logw_rotate(void) {
+    if (!logw_running) return -1;
+    return spsc_push(&logw_ring, "", 0);
+}
+
+unsigned long long logw_queue_depth(void) {
+    return logw_rows_queued - __atomic_load_n(&logw_rows_written, __ATOMIC_RELAXED);
+}
+
+/* Drains everything still queued, then joins the writer */
+void logw_stop_and_join(void) {
+    if (!logw_running) return;
+    __atomic_store_n(&logw_stop, 1, __ATOMIC_RELEASE);
+    pthread_join(logw_thread, NULL);
+    logw_running = 0;
+}
+
+/* Log Rotation and Compression
+ * The active log keeps its --log name. When a segment passes --log-max-size
+ * or --log-rotate seconds, it is renamed to <log>.<YYYYmmdd-HHMMSS> and a new
+ * segment starting with the same header is opened. The sampling thread only
+ * decides when to rotate (so binary delta coding can restart with the new
+ * header); the writer thread switches files and a separate compressor
+ * thread packs finished segments, so neither touches the sampling loop.
+ * Compression uses gzip when built with zlib and the built-in ULZ codec
+ * otherwise; `umon --unpack FILE.ulz` restores a ULZ segment. */
+unsigned long long opt_log_max_size = 0;
+int opt_log_rotate_sec = 0;
+int opt_log_compress = 0;
+int opt_log_keep = 0;
+
+unsigned long long log_seg_bytes = 0;
+double log_seg_start = 0;
+
+#define MAX_KEEP_SEGMENTS 1024
+char **seg_names = NULL;
+int seg_name_count = 0;
+
+/* Parses sizes like 500000, 64K, 100M or 2G */
+unsigned long long parse_size(const char *s) {
+    char *end;
+    unsigned long long v = strtoull(s, &end, 10);
+    switch (toupper((unsigned char)*end)) {
+        case 'K': v <<= 10; break;
+        case 'M': v <<= 20; break;
+        case 'G': v <<= 30; break;
+    }
+    return v;
+}
+
+/* Built-in ULZ codec: LZ77 with 64 KiB blocks in the LZ4 sequence layout.
+ * File: "ULZ1", then blocks of u32 raw length, u32 packed length, data,
+ * terminated by a zero raw length. */
+#define ULZ_MAGIC "ULZ1"
+#define ULZ_BLOCK 65536
+#define ULZ_HASH_BITS 13
+#define ULZ_MIN_MATCH 4
+
+size_t ulz_bound(size_t n) {
+    return n + n / 255 + 16;
+}
+
+void ulz_put_len(unsigned char *out, size_t *op, size_t len) {
+    while (len >= 255) {
+        out[(*op)++] = 255;
+        len -= 255;
+    }
+    out[(*op)++] = (unsigned char)len;
+}
+
+size_t ulz_compress(const unsigned char *in, size_t n, unsigned char *out) {
+    uint32_t table[1 << ULZ_HASH_BITS];
+    size_t ip = 0, anchor = 0, op = 0;
+    memset(table, 0, sizeof(table));
+    
+    while (n >= 12 && ip + ULZ_MIN_MATCH + 5 <= n) {
+        uint32_t seq;
+        memcpy(&seq, in + ip, 4);
+        uint32_t h = (seq * 2654435761u) >> (32 - ULZ_HASH_BITS);
+        size_t ref = table[h];
+        table[h] = (uint32_t)ip + 1;
+        if (ref == 0 || ip - (ref - 1) > 65535 || memcmp(in + ref - 1, in + ip, ULZ_MIN_MATCH) != 0) {
+            ip++;
+            continue;
+        }
+        size_t mpos = ref - 1, mlen = ULZ_MIN_MATCH;
+        while (ip + mlen < n - 5 && in[mpos + mlen] == in[ip + mlen]) mlen++;
+        
+        size_t lit = ip - anchor, ml = mlen - ULZ_MIN_MATCH;
+        out[op++] = (unsigned char)(((lit < 15 ? lit : 15) << 4) | (ml < 15 ? ml : 15));
+        if (lit >= 15) ulz_put_len(out, &op, lit - 15);
+        memcpy(out + op, in + anchor, lit);
+        op += lit;
+        size_t off = ip - mpos;
+        out[op++] = (unsigned char)(off & 0xff);
+        out[op++] = (unsigned char)(off >> 8);
+        if (ml >= 15) ulz_put_len(out, &op, ml - 15);
+        ip += mlen;
+        anchor = ip;
+    }
+    
+    size_t lit = n - anchor;
+    out[op++] = (unsigned char)((lit < 15 ? lit : 15) << 4);
+    if (lit >= 15) ulz_put_len(out, &op, lit - 15);
+    memcpy(out + op, in + anchor, lit);
+    return op + lit;
+}
+
+/* Returns the unpacked length, or -1 on corrupt input */
+long ulz_decompress(const unsigned char *in, size_t n, unsigned char *out, size_t cap) {
+    size_t ip = 0, op = 0;
+    while (ip < n) {
+        unsigned token = in[ip++];
+        size_t lit = token >> 4;
+        if (lit == 15) {
+            unsigned char b;
+            do {
+                if (ip >= n) return -1;
+                b = in[ip++];
+                lit += b;
+            } while (b == 255);
+        }
+        if (ip + lit > n || op + lit > cap) return -1;
+        memcpy(out + op, in + ip, lit);
+        ip += lit;
+        op += lit;
+        if (ip >= n) break;
+        
+        if (ip + 2 > n) return -1;
+        size_t off = in[ip] | (in[ip + 1] << 8);
+        ip += 2;
+        size_t ml = token & 15;
+        if (ml == 15) {
+            unsigned char b;
+            do {
+                if (ip >= n) return -1;
+                b = in[ip++];
+                ml += b;
+            } while (b == 255);
+        }
+        ml += ULZ_MIN_MATCH;
+        if (off == 0 || off > op || op + ml > cap) return -1;
+        for (size_t i = 0; i < ml; i++, op++) out[op] = out[op - off];
+    }
+    return (long)op;
+}
+
+int ulz_compress_file(const char *src, const char *dst) {
+    FILE *in = fopen(src, "rb");
+    if (!in) return -1;
+    FILE *out = fopen(dst, "wb");
+    if (!out) {
+        fclose(in);
+        return -1;
+    }
+    unsigned char *raw = malloc(ULZ_BLOCK), *packed = malloc(ulz_bound(ULZ_BLOCK));
+    int rc = (raw && packed) ? 0 : -1;
+    size_t n;
+    if (rc == 0) fwrite(ULZ_MAGIC, 1, 4, out);
+    while (rc == 0 && (n = fread(raw, 1, ULZ_BLOCK, in)) > 0) {
+        size_t c = ulz_compress(raw, n, packed);
+        uint32_t hdr[2] = { (uint32_t)n, (uint32_t)c };
+        if (fwrite(hdr, sizeof(hdr), 1, out) != 1 || fwrite(packed, 1, c, out) != c) rc = -1;
+    }
+    uint32_t end = 0;
+    if (rc == 0 && fwrite(&end, sizeof(end), 1, out) != 1) rc = -1;
+    free(raw);
+    free(packed);
+    fclose(in);
+    if (fclose(out) != 0) rc = -1;
+    return rc;
+}
+
+/* Writes the unpacked contents of a ULZ file to stdout */
+int ulz_unpack(const char *path) {
+    FILE *in = fopen(path, "rb");
+    if (!in) {
+        perror("Failed to open file");
+        return 1;
+    }
+    char magic[4];
+    unsigned char *raw = malloc(ULZ_BLOCK), *packed = malloc(ulz_bound(ULZ_BLOCK));
+    int rc = 1;
+    if (raw && packed && fread(magic, 1, 4, in) == 4 && memcmp(magic, ULZ_MAGIC, 4) == 0) {
+        uint32_t hdr[2];
+        for (;;) {
+            if (fread(hdr, sizeof(uint32_t), 1, in) != 1) break;
+            if (hdr[0] == 0) {
+                rc = 0;
+                break;
+            }
+            if (hdr[0] > ULZ_BLOCK || fread(&hdr[1], sizeof(uint32_t), 1, in) != 1 ||
+                hdr[1] > ulz_bound(ULZ_BLOCK) || fread(packed, 1, hdr[1], in) != hdr[1]) break;
+            long n = ulz_decompress(packed, hdr[1], raw, ULZ_BLOCK);
+            if (n != (long)hdr[0]) break;
+            fwrite(raw, 1, n, stdout);
+        }
+    }
+    if (rc) fprintf(stderr, "%s: not a valid ULZ file\n", path);
+    free(raw);
+    free(packed);
+    fclose(in);
+    return rc;
+}
+
+int compress_segment(const char *path) {
+    char dst[4096];
+#ifdef HAVE_ZLIB
+    snprintf(dst, sizeof(dst), "%s.gz", path);
+    FILE *in = fopen(path, "rb");
+    gzFile out = gzopen(dst, "wb6");
+    int rc = (in && out) ? 0 : -1;
+    char buf[65536];
+    size_t n;
+    while (rc == 0 && (n = fread(buf, 1, sizeof(buf), in)) > 0) {
+        if (gzwrite(out, buf, (unsigned)n) != (int)n) rc = -1;
+    }
+    if (in) fclose(in);
+    if (out && gzclose(out) != Z_OK) rc = -1;
+#else
+    snprintf(dst, sizeof(dst), "%s.ulz", path);
+    int rc = ulz_compress_file(path, dst);
+#endif
+    if (rc == 0) unlink(path);
+    else unlink(dst);
+    return rc;
+}
+
+/* Compressor thread: a small mutex-protected queue of finished segments.
+ * Rotations are rare, so a lock here costs nothing on the hot path. The
+ * lock also guards seg_names, which the writer and the compressor both
+ * prune. */
+#define COMPRESS_QUEUE 16
+pthread_t compress_thread;
+pthread_mutex_t compress_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t compress_cond = PTHREAD_COND_INITIALIZER;
+char *compress_jobs[COMPRESS_QUEUE];
+int compress_job_count = 0;
+char *compress_current = NULL;
+unsigned long long compress_dropped = 0;
+int compress_running = 0;
+int compress_stop = 0;
+
+/* Whether a segment is queued or being packed; needs compress_lock */
+int compress_busy(const char *path) {
+    if (compress_current && strcmp(compress_current, path) == 0) return 1;
+    for (int i = 0; i < compress_job_count; i++) {
+        if (strcmp(compress_jobs[i], path) == 0) return 1;
+    }
+    return 0;
+}
+
+/* Deletes the oldest segments beyond --log-keep, in any packed form. One
+ * that is still queued or being packed is left for the compressor to
+ * prune when it is done, so its packed file is not orphaned. Needs
+ * compress_lock. */
+void prune_segments_locked(void) {
+    int keep = opt_log_keep < MAX_KEEP_SEGMENTS ? opt_log_keep : MAX_KEEP_SEGMENTS;
+    while (seg_name_count > keep && !compress_busy(seg_names[0])) {
+        char path[4096];
+        unlink(seg_names[0]);
+        snprintf(path, sizeof(path), "%s.gz", seg_names[0]);
+        unlink(path);
+        snprintf(path, sizeof(path), "%s.ulz", seg_names[0]);
+        unlink(path);
+        free(seg_names[0]);
+        memmove(seg_names, seg_names + 1, (seg_name_count - 1) * sizeof(char *));
+        seg_name_count--;
+    }
+}
+
+void *compress_main(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&compress_lock);
+    for (;;) {
+        while (compress_job_count == 0 && !compress_stop) pthread_cond_wait(&compress_cond, &compress_lock);
+        if (compress_job_count == 0) break;
+        compress_current = compress_jobs[0];
+        memmove(compress_jobs, compress_jobs + 1, (compress_job_count - 1) * sizeof(char *));
+        compress_job_count--;
+        pthread_mutex_unlock(&compress_lock);
+        compress_segment(compress_current);
+        pthread_mutex_lock(&compress_lock);
+        free(compress_current);
+        compress_current = NULL;
+        if (seg_names) prune_segments_locked();
+    }
+    pthread_mutex_unlock(&compress_lock);
+    return NULL;
+}
+
+/* A full queue leaves the segment uncompressed; the drops are counted */
+void compress_enqueue(const char *path) {
+    pthread_mutex_lock(&compress_lock);
+    if (!compress_running && pthread_create(&compress_thread, NULL, compress_main, NULL) == 0) {
+        compress_running = 1;
+    }
+    char *job = compress_running && compress_job_count < COMPRESS_QUEUE ? strdup(path) : NULL;
+    if (job) {
+        compress_jobs[compress_job_count++] = job;
+        pthread_cond_signal(&compress_cond);
+    } else {
+        compress_dropped++;
+    }
+    pthread_mutex_unlock(&compress_lock);
+}
+
+/* Finishes queued compression jobs and joins the compressor */
+void compress_stop_and_join(void) {
+    pthread_mutex_lock(&compress_lock);
+    int running = compress_running;
+    compress_stop = 1;
+    pthread_cond_signal(&compress_cond);
+    pthread_mutex_unlock(&compress_lock);
+    if (running) pthread_join(compress_thread, NULL);
+    compress_running = 0;
+}
+
+/* Tracks a rotated segment for --log-keep. Segments held back while busy
+ * are at most the queue plus the one in flight, hence the extra room. */
+void prune_segments(const char *rotated) {
+    if (opt_log_keep <= 0) return;
+    pthread_mutex_lock(&compress_lock);
+    if (!seg_names) seg_names = calloc(MAX_KEEP_SEGMENTS + COMPRESS_QUEUE + 1, sizeof(char *));
+    if (seg_names && seg_name_count < MAX_KEEP_SEGMENTS + COMPRESS_QUEUE + 1) {
+        char *name = strdup(rotated);
+        if (name) seg_names[seg_name_count++] = name;
+        prune_segments_locked();
+    }
+    pthread_mutex_unlock(&compress_lock);
+}
+
+/* A name is taken while any form of its segment exists */
+int segment_exists(const char *path) {
+    char packed[4096 + 8];
+    if (access(path, F_OK) == 0) return 1;
+    snprintf(packed, sizeof(packed), "%s.gz", path);
+    if (access(packed, F_OK) == 0) return 1;
+    snprintf(packed, sizeof(packed), "%s.ulz", path);
+    return access(packed, F_OK) == 0;
+}
+
+/* Writer side: closes the active segment, renames it with its end time and
+ * opens a fresh one that starts with the header. */
+void rotate_log_file(void) {
+    char stamp[32], path[4096];
+    time_t now = time(NULL);
+    strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", localtime(&now));
+    snprintf(path, sizeof(path), "%s.%s", opt_log, stamp);
+    for (int n = 1; segment_exists(path); n++) {
+        snprintf(path, sizeof(path), "%s.%s-%d", opt_log, stamp, n);
+    }
+    
+    close(log_fd);
+    if (rename(opt_log, path) != 0) path[0] = '\0';
+    log_fd = open(opt_log, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (log_fd >= 0 && write_all(log_fd, logw_header.buf, logw_header.len) != 0) logw_write_errors++;
+    
+    if (path[0]) {
+        prune_segments(path);
+        if (opt_log_compress) compress_enqueue(path);
+    }
+}
+
+/* Sampling side: whether the next row of len bytes should start a segment */
+int log_rotation_due(double now, size_t len) {
+    if (opt_log_max_size > 0 && log_seg_bytes > logw_header.len && log_seg_bytes + len > opt_log_max_size) return 1;
+    if (opt_log_rotate_sec > 0 && now - log_seg_start >= opt_log_rotate_sec) return 1;
+    return 0;
+}
+
+double *log_row = NULL;
+strbuf_t log_buf;
+
+void write_log_header(void) {
+    if (log_fd < 0 || log_header_written) return;
+    log_buf.len = 0;
+    if (opt_log_format == LOG_FORMAT_BIN) {
+        bin_prev = calloc(log_col_count ? log_col_count : 1, sizeof(long long));
+        bin_encode_header(&log_buf);
+    } else {
+        csv_encode_header(&log_buf);
+    }
+    if (logw_start(log_buf.buf, log_buf.len) != 0) {
+        fprintf(stderr, "Failed to start log writer\n");
+        close(log_fd);
+        log_fd = -1;
+        return;
+    }
+    log_seg_bytes = log_buf.len;
+    log_seg_start = get_time_sec();
+    log_header_written = 1;
+}
+
+void log_data(const sample_t *s) {
+    if (!log_header_written || !log_row) return;
+    sample_to_row(s, log_row);
+    log_buf.len = 0;
+    if (opt_log_format == LOG_FORMAT_BIN) bin_encode_row(&log_buf, s->wall, log_row);
+    else csv_encode_row(&log_buf, s->wall, log_row);
+    
+    if (log_rotation_due(s->mono, log_buf.len) && logw_rotate() == 0) {
+        log_seg_bytes = logw_header.len;
+        log_seg_start = s->mono;
+        if (opt_log_format == LOG_FORMAT_BIN) {
+            /* The new segment must decode on its own: restart delta coding */
+            log_buf.len = 0;
+            bin_reset();
+            bin_encode_row(&log_buf, s->wall, log_row);
+        }
+    }
+    logw_submit(log_buf.buf, log_buf.len);
+    log_seg_bytes += log_buf.len;
+}
+
+/* Sample Ring Buffer
+ * The last N rows are kept in one block allocated when the schema is known,
+ * so sampling never allocates afterwards. SIGUSR1 asks for the ring to be
+ * written out as CSV to the --ring-dump file. */
+int opt_ring = 0;
+char *opt_ring_dump = "umon-ring.csv";
+double *ring_rows = NULL;
+double *ring_walls = NULL;
+int ring_head = 0;
+int ring_count = 0;
+volatile sig_atomic_t ring_dump_requested = 0;
+
+void handle_ring_dump(int sig) {
+    (void)sig;
+    ring_dump_requested = 1;
+}
+
+int ring_init(int slots) {
+    ring_rows = calloc((size_t)slots * log_col_count, sizeof(double));
+    ring_walls = calloc(slots, sizeof(double));
+    if (!ring_rows || !ring_walls) return -1;
+    opt_ring = slots;
+    return 0;
+}
+
+void ring_push(const sample_t *s) {
+    if (!ring_rows) return;
+    sample_to_row(s, &ring_rows[(size_t)ring_head * log_col_count]);
+    ring_walls[ring_head] = s->wall;
+    ring_head = (ring_head + 1) % opt_ring;
+    if (ring_count < opt_ring) ring_count++;
+}
+
+/* Writes the buffered samples, oldest first, in the CSV log layout */
+int ring_dump(const char *path) {
+    if (!ring_rows || opt_ring <= 0) return 0;
+    FILE *fp = fopen(path, "w");
+    if (!fp) return -1;
+    strbuf_t out = { 0 };
+    csv_encode_header(&out);
+    int start = (ring_head - ring_count + opt_ring) % opt_ring;
+    for (int i = 0; i < ring_count; i++) {
+        int slot = (start + i) % opt_ring;
+        csv_encode_row(&out, ring_walls[slot], &ring_rows[(size_t)slot * log_col_count]);
+    }
+    fwrite(out.buf, 1, out.len, fp);
+    free(out.buf);
+    return fclose(fp);
+}
+
+/* Shared-Memory Snapshot
+ * --shm NAME publishes every tick into /dev/shm/NAME in the layout of
+ * umon_shm.h: the log schema's column names once, then the row values
+ * under a seqlock. sample_to_row() writes straight into the segment while
+ * seq is odd, so publishing is one row flatten and two stores to seq. */
+umon_shm_header_t *shm_hdr = NULL;
+size_t shm_size = 0;
+char shm_path[256];
+
+/* Sizes the segment for the fixed log schema; needs build_log_schema() */
+int shm_create(const char *name) {
+    snprintf(shm_path, sizeof(shm_path), "/%s", name[0] == '/' ? name + 1 : name);
+    size_t names = sizeof(umon_shm_header_t);
+    size_t values = names + (size_t)log_col_count * UMON_SHM_NAME_SIZE;
+    values = (values + 7) & ~(size_t)7;
+    shm_size = values + (size_t)log_col_count * sizeof(double);
+    
+    /* A fresh object each run: readers still mapped to an earlier run's
+     * segment keep that memory intact instead of seeing it resized */
+    shm_unlink(shm_path);
+    int fd = shm_open(shm_path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (fd < 0) return -1;
+    if (ftruncate(fd, shm_size) != 0) {
+        close(fd);
+        shm_unlink(shm_path);
+        return -1;
+    }
+    void *p = mmap(NULL, shm_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        shm_unlink(shm_path);
+        return -1;
+    }
+    
+    shm_hdr = p;
+    shm_hdr->version = UMON_SHM_VERSION;
+    shm_hdr->header_size = sizeof(umon_shm_header_t);
+    shm_hdr->col_count = log_col_count;
+    shm_hdr->name_size = UMON_SHM_NAME_SIZE;
+    shm_hdr->names_offset = names;
+    shm_hdr->values_offset = values;
+    shm_hdr->size = shm_size;
+    shm_hdr->pid = getpid();
+    for (int i = 0; i < log_col_count; i++) {
+        snprintf((char *)p + names + (size_t)i * UMON_SHM_NAME_SIZE, UMON_SHM_NAME_SIZE, "%s", log_cols[i].name);
+    }
+    __atomic_store_n(&shm_hdr->magic, UMON_SHM_MAGIC, __ATOMIC_RELEASE);
+    return 0;
+}
+
+void shm_publish(const sample_t *s) {
+    if (!shm_hdr) return;
+    uint64_t seq = shm_hdr->seq;
+    __atomic_store_n(&shm_hdr->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    sample_to_row(s, (double *)((char *)shm_hdr + shm_hdr->values_offset));
+    shm_hdr->tick++;
+    shm_hdr->wall = s->wall;
+    __atomic_store_n(&shm_hdr->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+/* Clearing magic tells attached readers that the writer has gone */
+void shm_close(void) {
+    if (!shm_hdr) return;
+    __atomic_store_n(&shm_hdr->magic, 0, __ATOMIC_RELEASE);
+    munmap(shm_hdr, shm_size);
+    shm_hdr = NULL;
+    shm_unlink(shm_path);
+}
+
+/* Metrics Endpoint
+ * --listen serves the latest sample as Prometheus text over HTTP, on a
+ * Unix socket or a localhost TCP port. The listener and its clients live
+ * on a private epoll set that is itself one sched_watch() on the main
+ * loop, so everything stays on the sampling thread without blocking and
+ * the client count is not bounded by MAX_WATCHES. The response, headers
+ * included, is rendered once per tick into a refcounted body; clients
+ * that are still sending keep the body they started with, so a scrape
+ * only costs the send() calls. Connections close after one response. */
+#define METRICS_CLIENTS 64
+#define METRICS_REQ_MAX 2048
+#define METRICS_IDLE_SEC 5.0
+#define METRICS_LISTENER 0xffffffffu
+
+typedef struct {
+    int refs;
+    strbuf_t sb;
+} metrics_body_t;
+
+typedef struct {
+    int fd;                     /* -1 = free */
+    char req[METRICS_REQ_MAX];
+    size_t req_len;
+    metrics_body_t *body;       /* held while a metrics response is sent */
+    const char *resp;
+    size_t resp_len;
+    size_t sent;
+    double since;
+} metrics_client_t;
+
+int metrics_fd = -1;
+int metrics_epfd = -1;
+char metrics_unix_path[108];
+metrics_client_t metrics_clients[METRICS_CLIENTS];
+metrics_body_t *metrics_cur = NULL;
+metrics_body_t *metrics_spare = NULL;
+strbuf_t metrics_text;
+unsigned long long metrics_scrapes = 0;
+int metrics_show_cpu = 0, metrics_show_mem = 0, metrics_show_disks = 0, metrics_show_net = 0;
+
+const char metrics_404[] = "HTTP/1.0 404 Not Found\r\nContent-Type: text/plain\r\n"
+                           "Content-Length: 10\r\nConnection: close\r\n\r\nnot found\n";
+
+void metrics_unref(metrics_body_t *b) {
+    if (!b || --b->refs > 0) return;
+    if (!metrics_spare) {
+        metrics_spare = b;
+        return;
+    }
+    free(b->sb.buf);
+    free(b);
+}
+
+/* Writes a label value with Prometheus escaping */
+void prom_label(strbuf_t *sb, const char *v) {
+    for (; *v; v++) {
+        if (*v == '\\' || *v == '"') sb_printf(sb, "\\%c", *v);
+        else if (*v == '\n') sb_append(sb, "\\n", 2);
+        else sb_append(sb, v, 1);
+    }
+}
+
+void prom_family(strbuf_t *sb, const char *name, const char *help) {
+    sb_printf(sb, "# HELP %s %s\n# TYPE %s gauge\n", name, help, name);
+}
+
+void prom_labeled(strbuf_t *sb, const char *name, const char *label, const char *value, double v) {
+    sb_printf(sb, "%s{%s=\"", name, label);
+    prom_label(sb, value);
+    sb_printf(sb, "\"} %.17g\n", v);
+}
+
+void metrics_render(const sample_t *s, strbuf_t *sb) {
+    char core[16];
+    sb->len = 0;
+    
+    if (metrics_show_cpu) {
+        prom_family(sb, "umon_cpu_usage_percent", "CPU busy time over the last interval.");
+        prom_labeled(sb, "umon_cpu_usage_percent", "cpu", "all", s->cpu_total);
+        for (int i = 0; i < num_cores; i++) {
+            snprintf(core, sizeof(core), "%d", i);
+            prom_labeled(sb, "umon_cpu_usage_percent", "cpu", core, s->cpu_cores[i]);
         }
     }
     
-    /* Log Disks */
-    if (show_disks) {
-        FILE *mtab = setmntent("/proc/mounts", "r");
-        if (mtab) {
-            struct mntent *ent;
-            while ((ent = getmntent(mtab)) != NULL) {
-                if (strncmp(ent->mnt_fsname, "/dev/", 5) == 0 && strstr(ent->mnt_fsname, "loop") == NULL) {
-                    struct statvfs s;
-                    if (statvfs(ent->mnt_dir, &s) == 0) {
-                        unsigned long long total = s.f_blocks * s.f_frsize;
-                        unsigned long long free = s.f_bfree * s.f_frsize;
-                        unsigned long long used = total - free;
-                        double pct = (total > 0) ? ((double)used / total) * 100.0 : 0.0;
-                        fprintf(log_fp, ",%llu,%llu,%.2f", used, total, pct);
-                    } else {
-                        fprintf(log_fp, ",0,0,0");
-                    }
-                }
+    if (metrics_show_mem) {
+        prom_family(sb, "umon_memory_used_bytes", "RAM in use (total minus available).");
+        sb_printf(sb, "umon_memory_used_bytes %.17g\n", s->ram_used);
+        prom_family(sb, "umon_memory_total_bytes", "Total RAM.");
+        sb_printf(sb, "umon_memory_total_bytes %.17g\n", s->ram_total);
+        prom_family(sb, "umon_swap_used_bytes", "Swap in use.");
+        sb_printf(sb, "umon_swap_used_bytes %.17g\n", s->swap_used);
+        prom_family(sb, "umon_swap_total_bytes", "Total swap.");
+        sb_printf(sb, "umon_swap_total_bytes %.17g\n", s->swap_total);
+    }
+    
+    if (metrics_show_disks) {
+        static const char *fs_names[3] = {
+            "umon_filesystem_used_bytes", "umon_filesystem_size_bytes", "umon_filesystem_stale"
+        };
+        static const char *fs_help[3] = {
+            "Used filesystem space.", "Filesystem size.", "1 when statvfs has not answered in time."
+        };
+        for (int m = 0; m < 3; m++) {
+            prom_family(sb, fs_names[m], fs_help[m]);
+            for (int i = 0; i < s->disk_count; i++) {
+                const disk_stats_t *d = &s->disks[i];
+                if (!d->ok && m < 2) continue;
+                double v = m == 0 ? (double)d->used : m == 1 ? (double)d->total : d->stale;
+                sb_printf(sb, "%s{device=\"", fs_names[m]);
+                prom_label(sb, d->fsname);
+                sb_append(sb, "\",mountpoint=\"", 14);
+                prom_label(sb, d->dir);
+                sb_printf(sb, "\"} %.17g\n", v);
+            }
+        }
+        
+        static const char *io_names[5] = {
+            "umon_disk_read_bytes_per_second", "umon_disk_write_bytes_per_second",
+            "umon_disk_reads_per_second", "umon_disk_writes_per_second", "umon_disk_utilization_percent"
+        };
+        static const char *io_help[5] = {
+            "Bytes read per second.", "Bytes written per second.", "Read requests per second.",
+            "Write requests per second.", "Time the device was busy."
+        };
+        for (int m = 0; s->diskio_ready && m < 5; m++) {
+            prom_family(sb, io_names[m], io_help[m]);
+            for (int i = 0; i < s->diskio_count; i++) {
+                const diskio_sample_t *d = &s->diskio[i];
+                if (!d->valid) continue;
+                double v = m == 0 ? d->r_bps : m == 1 ? d->w_bps : m == 2 ? d->r_iops : m == 3 ? d->w_iops : d->util_pct;
+                prom_labeled(sb, io_names[m], "device", d->name, v);
             }
-            endmntent(mtab);
         }
     }
     
-    /* Log Network */
-    if (show_net) {
-        double curr_time = get_time_sec();
-        double dt = curr_time - last_net_time;
-        int first_run = (last_net_time == 0);
-        
-        FILE *f = fopen("/proc/net/dev", "r");
-        if (f) {
-            char line[512];
-            fgets(line, sizeof(line), f);
-            fgets(line, sizeof(line), f);
-            
-            while (fgets(line, sizeof(line), f)) {
-                char *p = line;
-                while (*p == ' ') p++;
-                char *end = strchr(p, ':');
-                if (end) {
-                    *end = '\0';
-                    char *ifname = p;
-                    
-                    if (opt_net_iface == NULL || strcmp(opt_net_iface, ifname) == 0) {
-                        p = end + 1;
-                        unsigned long long r_bytes, s_bytes;
-                        sscanf(p, "%llu %*s %*s %*s %*s %*s %*s %*s %llu", &r_bytes, &s_bytes);
-                        
-                        if (!first_run && dt > 0) {
-                            for (int i = 0; i < net_prev_count; i++) {
-                                if (strcmp(net_prev[i].name, ifname) == 0) {
-                                    double rx_spd = (r_bytes - net_prev[i].bytes_recv) / dt;
-                                    double tx_spd = (s_bytes - net_prev[i].bytes_sent) / dt;
-                                    fprintf(log_fp, ",%.2f,%.2f", rx_spd, tx_spd);
-                                    break;
-                                }
-                            }
-                        } else {
-                            fprintf(log_fp, ",0,0");
-                        }
-                    }
-                }
-            }
-            fclose(f);
+    if (metrics_show_net && s->net_ready) {
+        prom_family(sb, "umon_network_receive_bytes_per_second", "Bytes received per second.");
+        for (int i = 0; i < s->net_count; i++) {
+            if (s->net[i].valid) prom_labeled(sb, "umon_network_receive_bytes_per_second", "interface", s->net[i].name, s->net[i].rx_bps);
+        }
+        prom_family(sb, "umon_network_transmit_bytes_per_second", "Bytes sent per second.");
+        for (int i = 0; i < s->net_count; i++) {
+            if (s->net[i].valid) prom_labeled(sb, "umon_network_transmit_bytes_per_second", "interface", s->net[i].name, s->net[i].tx_bps);
+        }
+    }
+    
+    if (opt_psi && s->psi_ready) {
+        prom_family(sb, "umon_pressure_some_percent", "Share of time some tasks stalled over the last interval.");
+        for (int r = 0; r < PSI_COUNT; r++) {
+            if (s->psi[r].ok) prom_labeled(sb, "umon_pressure_some_percent", "resource", psi_names[r], s->psi[r].some_stall);
+        }
+        prom_family(sb, "umon_pressure_full_percent", "Share of time all tasks stalled over the last interval.");
+        for (int r = 0; r < PSI_COUNT; r++) {
+            if (s->psi[r].ok) prom_labeled(sb, "umon_pressure_full_percent", "resource", psi_names[r], s->psi[r].full_stall);
         }
     }
     
-    fprintf(log_fp, "\n");
-    fflush(log_fp);
+    prom_family(sb, "umon_sample_timestamp_seconds", "Wall time the sample was taken.");
+    sb_printf(sb, "umon_sample_timestamp_seconds %.3f\n", s->wall);
+}
+
+/* Renders this tick's response. The current body is rewritten in place
+ * when no client holds it, else it is swapped for a fresh one. */
+void metrics_publish(const sample_t *s) {
+    if (metrics_fd < 0) return;
+    metrics_render(s, &metrics_text);
+    
+    metrics_body_t *b = metrics_cur;
+    if (!b || b->refs > 1) {
+        if (b) metrics_unref(b);
+        b = metrics_spare ? metrics_spare : calloc(1, sizeof(metrics_body_t));
+        metrics_spare = NULL;
+        if (!b) {
+            metrics_cur = NULL;
+            return;
+        }
+        b->refs = 1;
+        metrics_cur = b;
+    }
+    b->sb.len = 0;
+    sb_printf(&b->sb, "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+                      "Content-Length: %zu\r\nConnection: close\r\n\r\n", metrics_text.len);
+    sb_append(&b->sb, metrics_text.buf, metrics_text.len);
+    
+    /* Drop clients that never finished their request or stopped reading */
+    double now = get_time_sec();
+    for (int i = 0; i < METRICS_CLIENTS; i++) {
+        metrics_client_t *c = &metrics_clients[i];
+        if (c->fd >= 0 && now - c->since > METRICS_IDLE_SEC) {
+            close(c->fd);
+            c->fd = -1;
+            metrics_unref(c->body);
+            c->body = NULL;
+        }
+    }
+}
+
+void metrics_client_close(metrics_client_t *c) {
+    close(c->fd);
+    c->fd = -1;
+    metrics_unref(c->body);
+    c->body = NULL;
+}
+
+/* Sends what the socket takes; waits for EPOLLOUT when it is full */
+void metrics_client_send(metrics_client_t *c, uint32_t id) {
+    while (c->sent < c->resp_len) {
+        ssize_t n = send(c->fd, c->resp + c->sent, c->resp_len - c->sent, MSG_NOSIGNAL);
+        if (n > 0) {
+            c->sent += n;
+            continue;
+        }
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            struct epoll_event ev;
+            memset(&ev, 0, sizeof(ev));
+            ev.events = EPOLLOUT;
+            ev.data.u32 = id;
+            epoll_ctl(metrics_epfd, EPOLL_CTL_MOD, c->fd, &ev);
+            return;
+        }
+        break;
+    }
+    metrics_client_close(c);
+}
+
+/* Reads the request head and starts the response once it is complete */
+void metrics_client_read(metrics_client_t *c, uint32_t id) {
+    for (;;) {
+        ssize_t n = recv(c->fd, c->req + c->req_len, sizeof(c->req) - 1 - c->req_len, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+        if (n <= 0) {
+            metrics_client_close(c);
+            return;
+        }
+        c->req_len += n;
+        c->req[c->req_len] = '\0';
+        if (strstr(c->req, "\r\n\r\n") || strstr(c->req, "\n\n")) break;
+        if (c->req_len + 1 >= sizeof(c->req)) {
+            metrics_client_close(c);
+            return;
+        }
+    }
+    
+    if ((strncmp(c->req, "GET /metrics ", 13) == 0 || strncmp(c->req, "GET / ", 6) == 0) && metrics_cur) {
+        c->body = metrics_cur;
+        c->body->refs++;
+        c->resp = c->body->sb.buf;
+        c->resp_len = c->body->sb.len;
+        metrics_scrapes++;
+    } else {
+        c->resp = metrics_404;
+        c->resp_len = sizeof(metrics_404) - 1;
+    }
+    c->sent = 0;
+    metrics_client_send(c, id);
+}
+
+void metrics_accept(void) {
+    for (;;) {
+        int fd = accept4(metrics_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR) continue;
+            return;
+        }
+        int id = 0;
+        while (id < METRICS_CLIENTS && metrics_clients[id].fd >= 0) id++;
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.u32 = id;
+        if (id == METRICS_CLIENTS || epoll_ctl(metrics_epfd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+            close(fd);
+            continue;
+        }
+        metrics_client_t *c = &metrics_clients[id];
+        c->fd = fd;
+        c->req_len = 0;
+        c->body = NULL;
+        c->resp = NULL;
+        c->resp_len = c->sent = 0;
+        c->since = get_time_sec();
+    }
+}
+
+/* sched_watch() handler for the private epoll set; never ends the wait */
+int metrics_io(int fd, uint32_t events) {
+    (void)events;
+    struct epoll_event evs[32];
+    int n = epoll_wait(fd, evs, 32, 0);
+    for (int i = 0; i < n; i++) {
+        uint32_t id = evs[i].data.u32;
+        if (id == METRICS_LISTENER) {
+            metrics_accept();
+            continue;
+        }
+        metrics_client_t *c = &metrics_clients[id];
+        if (c->fd < 0) continue;
+        if (c->resp) metrics_client_send(c, id);
+        else metrics_client_read(c, id);
+    }
+    return 0;
+}
+
+/* Binds "unix:PATH" (or any path with a slash), else "[HOST:]PORT" with
+ * HOST defaulting to 127.0.0.1 */
+int metrics_bind(const char *addr) {
+    if (strncmp(addr, "unix:", 5) == 0 || strchr(addr, '/')) {
+        const char *path = strncmp(addr, "unix:", 5) == 0 ? addr + 5 : addr;
+        struct sockaddr_un sun;
+        memset(&sun, 0, sizeof(sun));
+        sun.sun_family = AF_UNIX;
+        if (strlen(path) >= sizeof(sun.sun_path)) return -1;
+        strcpy(sun.sun_path, path);
+        /* A socket left by an earlier run is replaced; other files are not */
+        struct stat st;
+        if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) unlink(path);
+        int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd < 0) return -1;
+        if (bind(fd, (struct sockaddr *)&sun, sizeof(sun)) != 0 || listen(fd, 64) != 0) {
+            close(fd);
+            return -1;
+        }
+        snprintf(metrics_unix_path, sizeof(metrics_unix_path), "%s", path);
+        return fd;
+    }
+    
+    char host[256] = "127.0.0.1";
+    const char *port = addr;
+    const char *colon = strrchr(addr, ':');
+    if (colon) {
+        size_t hlen = colon - addr;
+        if (hlen > 1 && addr[0] == '[' && addr[hlen - 1] == ']') {
+            addr++;
+            hlen -= 2;
+        }
+        if (hlen > 0 && hlen < sizeof(host)) {
+            memcpy(host, addr, hlen);
+            host[hlen] = '\0';
+        }
+        port = colon + 1;
+    }
+    struct addrinfo hints, *res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE | AI_NUMERICSERV;
+    if (getaddrinfo(host, port, &hints, &res) != 0) return -1;
+    int fd = socket(res->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    int one = 1;
+    if (fd >= 0) setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (fd >= 0 && (bind(fd, res->ai_addr, res->ai_addrlen) != 0 || listen(fd, 64) != 0)) {
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    return fd;
+}
+
+void metrics_close(void) {
+    for (int i = 0; i < METRICS_CLIENTS; i++) {
+        if (metrics_clients[i].fd >= 0) metrics_client_close(&metrics_clients[i]);
+    }
+    if (metrics_epfd >= 0) close(metrics_epfd);
+    if (metrics_fd >= 0) close(metrics_fd);
+    metrics_epfd = metrics_fd = -1;
+    if (metrics_unix_path[0]) unlink(metrics_unix_path);
+    metrics_unix_path[0] = '\0';
+}
+
+/* Needs the scheduler for the epoll watch */
+int metrics_init(int show_cpu, int show_mem, int show_disks, int show_net) {
+    metrics_show_cpu = show_cpu;
+    metrics_show_mem = show_mem;
+    metrics_show_disks = show_disks;
+    metrics_show_net = show_net;
+    for (int i = 0; i < METRICS_CLIENTS; i++) metrics_clients[i].fd = -1;
+    
+    metrics_fd = metrics_bind(opt_listen);
+    if (metrics_fd < 0) return -1;
+    metrics_epfd = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.u32 = METRICS_LISTENER;
+    if (metrics_epfd < 0 || epoll_ctl(metrics_epfd, EPOLL_CTL_ADD, metrics_fd, &ev) != 0 ||
+        sched_watch(metrics_epfd, EPOLLIN, metrics_io) != 0) {
+        metrics_close();
+        return -1;
+    }
+    return 0;
 }
 
 void print_help(void) {
@@ -822,50 +5300,245 @@ void print_help(void) {
     printf("  -h, --help           Show this help message\n");
     printf("  --cpu                Display only CPU usage information\n");
     printf("  --mem                Display only memory usage\n");
-    printf("  --disks              Display only disk usage\n");
+    printf("  --disks              Display only disk usage and per-device I/O\n");
     printf("  --net [IFACE]        Display only network usage (optional: specific interface)\n");
     printf("  --netlist            List network interfaces and exit\n");
     printf("  --cpulist            Show CPU cores as a list\n");
+    printf("  --psi                Show pressure stall information for cpu, memory and io\n");
+    printf("  --psi-trigger MS     Also sample early when stalls exceed MS per second (implies --psi)\n");
+    printf("  --cgroup PATH|all    Show CPU, memory and I/O per cgroup v2 under PATH\n");
+    printf("  --procs N            Show the top N processes by CPU, with RSS and I/O rates\n");
+    printf("  --procs-sort KEY     Order the process view by cpu (default), rss or io\n");
     printf("  --mono               Disable colors\n");
+    printf("  --frame-stats        Show bytes sent to the terminal per frame\n");
+    printf("  --selfstat           Show and log umon's own CPU, RSS and per-stage p50/p99 cost\n");
+    printf("  --history N          Samples per metric for sparklines and min/avg/max/p95 (default 60, 0 = off)\n");
     printf("  --interval MS        Refresh interval in milliseconds (default 250)\n");
+    printf("  --statfs-timeout MS  Mark a mount stale when statvfs takes longer (default 1000)\n");
+    printf("  --period NAME=MS,..  Refresh a collector (cpu, mem, disk, diskio, net) every MS\n");
+    printf("  --adaptive [MS]      Sample every MS (default 20) while metrics are busy, else every --interval\n");
+    printf("  --adapt-threshold P  Go fast when CPU, I/O, link or PSI use reaches P (default 80, implies --adaptive)\n");
+    printf("  --adapt-slope R      Go fast when any percentage moves R points/s (default 100)\n");
+    printf("  --adapt-hold MS      Stay fast this long after the last trigger (default 2000)\n");
     printf("  --sysinfo            Display system info and exit\n");
     printf("  --log FILENAME       Log data to CSV file with the same interval\n");
+    printf("  --log-format FMT     Log format: csv (default) or bin (compact binary)\n");
+    printf("  --log-flush MS       Write queued log rows at least this often (default 1000)\n");
+    printf("  --log-queue KB       Log queue size; rows are dropped when it is full (default 1024)\n");
+    printf("  --log-max-size SIZE  Start a new log segment after SIZE bytes (K/M/G suffixes)\n");
+    printf("  --log-rotate SEC     Start a new log segment every SEC seconds\n");
+    printf("  --log-keep N         Keep only the N most recent rotated segments\n");
+    printf("  --log-compress       Compress rotated segments (gzip, or built-in .ulz)\n");
+    printf("  --unpack FILE        Decompress a .ulz segment to stdout and exit\n");
+    printf("  --dump FILE          Convert a binary log to CSV on stdout and exit\n");
+    printf("  --daemon             Run headless: sample and log without drawing the display\n");
+    printf("  --ring N             Keep the last N samples in memory (default 600 with --daemon)\n");
+    printf("  --record DIR         Capture the raw bytes of every procfs/sysfs read into DIR\n");
+    printf("  --replay DIR         Re-run a capture through the parsers at full speed, headless\n");
+    printf("  --shm NAME           Publish every sample to /dev/shm/NAME (layout in umon_shm.h)\n");
+    printf("  --listen ADDR        Serve Prometheus metrics over HTTP on unix:PATH or [HOST:]PORT\n");
+    printf("  --ring-dump FILE     Where SIGUSR1 writes the ring as CSV (default umon-ring.csv)\n");
     printf("\nLogging:\n");
     printf("  Use --log to save monitoring data to a CSV file.\n");
     printf("  The log includes all enabled metrics (CPU, memory, disks, network)\n");
     printf("  with timestamps. Data is written at each refresh interval.\n");
     printf("  Example: umon --cpu --mem --log system.csv\n");
+    printf("  With --log-format bin rows are delta-encoded integers; convert them\n");
+    printf("  back with: umon --dump system.bin > system.csv\n");
+    printf("  Rotated segments are named <log>.<YYYYmmdd-HHMMSS> and each starts\n");
+    printf("  with its own header, so every segment can be read on its own.\n");
+    printf("\nCollector periods:\n");
+    printf("  Each collector can refresh on its own period; the display and log\n");
+    printf("  show the latest value of each. The tick follows the fastest one.\n");
+    printf("  Example: umon --period cpu=50,disk=10000\n");
+    printf("\nAdaptive sampling:\n");
+    printf("  Log rows carry the time each sample was taken, so fast and slow\n");
+    printf("  stretches can be told apart. The display redraws at most every %d ms.\n", DISPLAY_PERIOD_MS);
+    printf("  Example: umon --daemon --interval 1000 --adaptive 20 --log spikes.csv\n");
+    printf("\nRecord and replay:\n");
+    printf("  A capture keeps the collectors, --period and --net IFACE it was taken with,\n");
+    printf("  and replay runs with those; --procs, --cgroup and --psi-trigger are not\n");
+    printf("  captured. Timestamps, link speeds and statvfs answers come from the capture,\n");
+    printf("  so a replayed --log is repeatable. Replay reports ticks/second.\n");
+    printf("  Example: umon --daemon --net --record cap; umon --replay cap --log out.csv\n");
+    printf("\nMetrics endpoint:\n");
+    printf("  --listen serves the latest sample at /metrics. A bare port binds to\n");
+    printf("  127.0.0.1; interfaces are included even without --net.\n");
+    printf("  Example: umon --daemon --listen 9101  (curl http://127.0.0.1:9101/metrics)\n");
+    printf("           umon --daemon --listen unix:/run/umon.sock\n");
+    printf("\nHeadless mode:\n");
+    printf("  --daemon keeps sampling without a terminal. Recent samples stay in a\n");
+    printf("  fixed-size ring; 'kill -USR1 <pid>' writes them out on demand.\n");
+    printf("  Example: umon --daemon --interval 100 --ring 3000 --ring-dump /run/umon.csv\n");
 }
 
 void print_oneline_help(void) {
     printf("umon v%s - System Resource Monitor by %s\n", __CODEVERSION__, __CODEAUTHOR__);
-    printf("Usage: umon [--cpu] [--mem] [--disks] [--net [IFACE]] [--mono] [--interval MS] [--log FILE] [--sysinfo] | -h | --help\n");
+    printf("Usage: umon [--cpu] [--mem] [--disks] [--net [IFACE]] [--psi] [--cgroup PATH|all] [--procs N] [--mono] [--interval MS] [--log FILE] [--daemon] [--ring N] [--sysinfo] | -h | --help\n");
     printf("Use '--help' for detailed information.\n");
 }
 
+/* Draws one frame of the interactive display from a sample */
+void render_frame(const sample_t *s, int show_cpu, int show_mem, int show_disks, int show_net) {
+    time_t t = (time_t)s->wall;
+    struct tm *tm = localtime(&t);
+    char time_str[10];
+    strftime(time_str, sizeof(time_str), "%H:%M:%S", tm);
+    
+    char title[128];
+    snprintf(title, sizeof(title), "System Monitor (v%s)", __CODEVERSION__);
+    
+    int total_width = 60;
+    int len_txt = strlen(title) + 1 + strlen(time_str);
+    int pad = total_width - len_txt;
+    int pad_l = pad / 2;
+    int pad_r = pad - pad_l;
+    
+    fb_printf("%s", c_magenta());
+    fb_repeat('=', total_width);
+    fb_printf("%s\n", c_reset());
+    
+    fb_printf("%s%s", c_bold(), c_cyan());
+    fb_repeat(' ', pad_l);
+    fb_printf("%s%s %s%s%s%s", title, c_reset(), c_dim(), c_white(), time_str, c_reset());
+    fb_repeat(' ', pad_r);
+    fb_printf("%s\n", c_reset());
+    
+    fb_printf("%s", c_magenta());
+    fb_repeat('=', total_width);
+    fb_printf("%s\n", c_reset());
+    
+    if (show_cpu) {
+        fb_printf("\n");
+        get_cpu_info(s, 30);
+    }
+    
+    if (show_mem) {
+        fb_printf("\n");
+        get_memory_info(s, 30);
+    }
+    
+    if (show_disks) {
+        fb_printf("\n");
+        get_disk_info(s, 30);
+    }
+    
+    if (show_net) {
+        fb_printf("\n");
+        get_net_info(s, 30);
+    }
+    
+    if (opt_psi) {
+        fb_printf("\n");
+        get_psi_info(s, 30);
+    }
+    
+    if (opt_cgroup) {
+        fb_printf("\n");
+        get_cgroup_info();
+    }
+    
+    if (opt_procs) {
+        fb_printf("\n");
+        get_procs_info();
+    }
+    
+    fb_printf("\nPress Ctrl+C to quit.");
+    if (opt_log) {
+        fb_printf(" Logging to: %s", opt_log);
+    }
+    fb_printf("\n");
+    if (opt_adaptive) {
+        fb_printf("%sSampling every %.0f ms (base %d ms, fast %d ms), %llu fast ticks%s\n", c_dim(),
+                  tick_period_ns / 1e6, sched_base_ms, opt_fast_interval, adapt_fast_ticks, c_reset());
+    }
+    int periodic = 0;
+    for (int c = 0; c < COLL_COUNT; c++) periodic |= (opt_period[c] > 0);
+    if (periodic) {
+        fb_printf("%sCollectors:", c_dim());
+        for (int c = 0; c < COLL_COUNT; c++) {
+            fb_printf(" %s %d ms%s", col_names[c], opt_period[c] ? opt_period[c] : sched_base_ms,
+                      c + 1 < COLL_COUNT ? "," : "");
+        }
+        fb_printf("%s\n", c_reset());
+    }
+    if (metrics_fd >= 0) {
+        fb_printf("%sServing metrics on %s, %llu scrapes%s\n", c_dim(), opt_listen, metrics_scrapes, c_reset());
+    }
+    if (opt_selfstat) {
+        char rss[32];
+        format_bytes(self_maxrss, rss, sizeof(rss));
+        fb_printf("%sSelf: %.2f%% CPU, max RSS %s; p50/p99 us:", c_dim(), self_cpu_pct, rss);
+        for (int st = 0; st < STAGE_COUNT; st++) {
+            if (self_len[st] > 0) fb_printf(" %s %.0f/%.0f", stage_names[st], self_p50[st], self_p99[st]);
+        }
+        fb_printf("%s\n", c_reset());
+    }
+    if (ticks_missed > 0) {
+        fb_printf("%sMissed ticks: %llu of %llu%s\n", c_yellow(), ticks_missed, ticks_done + ticks_missed, c_reset());
+    }
+    if (opt_psi_trigger_ms > 0) {
+        if (psi_triggers_armed > 0) {
+            fb_printf("%sPSI triggers: %d armed, %llu early wakeups%s\n", c_dim(), psi_triggers_armed, psi_wakeups, c_reset());
+        } else {
+            fb_printf("%sPSI triggers unavailable%s\n", c_yellow(), c_reset());
+        }
+    }
+    if (opt_frame_stats && fb_frames > 0) {
+        fb_printf("%sFrame: %zu bytes, avg %.0f bytes over %llu frames%s\n", c_dim(),
+                  fb_last_bytes, (double)fb_total_bytes / fb_frames, fb_frames, c_reset());
+    }
+    fb_flush();
+}
+
 /* Signal Handling */
+int screen_active = 0;
+
 void cleanup(void) {
-    if (!opt_mono) {
+    if (screen_active) {
+        screen_active = 0;
+        printf("\033[0m");
         printf("\033[?25h");
         printf("\033[?1049l");
         fflush(stdout);
     }
-    if (log_fp) {
-        fclose(log_fp);
-        log_fp = NULL;
+    metrics_close();
+    shm_close();
+    record_close();
+    logw_stop_and_join();
+    compress_stop_and_join();
+    if (log_fd >= 0) {
+        close(log_fd);
+        log_fd = -1;
     }
 }
 
 void handle_signal(int sig) {
     (void)sig;
-    cleanup();
+    stop_requested = 1;
+}
+
+void print_summary(void) {
     printf("\n\nMonitoring stopped.\n");
+    if (ticks_missed > 0) {
+        printf("Missed ticks: %llu of %llu\n", ticks_missed, ticks_done + ticks_missed);
+    }
+    if (opt_frame_stats && fb_frames > 0) {
+        printf("Frames: %llu, %llu bytes sent, avg %.0f bytes/frame\n",
+               fb_frames, fb_total_bytes, (double)fb_total_bytes / fb_frames);
+    }
     if (opt_log) {
         printf("Log saved to: %s\n", opt_log);
+        if (logw_rows_dropped > 0 || logw_write_errors > 0) {
+            printf("Log rows dropped: %llu, write errors: %llu\n", logw_rows_dropped, logw_write_errors);
+        }
+        if (compress_dropped > 0) {
+            printf("Segments left uncompressed (queue full): %llu\n", compress_dropped);
+        }
     }
-    exit(0);
 }
 
+#ifndef UMON_NO_MAIN
 int main(int argc, char **argv) {
     for (int i = 1; i < argc; i++) {
         if (strcmp(argv[i], "-h") == 0) {
@@ -881,6 +5554,50 @@ int main(int argc, char **argv) {
         else if (strcmp(argv[i], "--disks") == 0) opt_disks = 1;
         else if (strcmp(argv[i], "--cpulist") == 0) opt_cpulist = 1;
         else if (strcmp(argv[i], "--mono") == 0) opt_mono = 1;
+        else if (strcmp(argv[i], "--frame-stats") == 0) opt_frame_stats = 1;
+        else if (strcmp(argv[i], "--selfstat") == 0) opt_selfstat = 1;
+        else if (strcmp(argv[i], "--history") == 0) {
+            if (i + 1 < argc) opt_history = atoi(argv[++i]);
+            if (opt_history < 0 || opt_history > HIST_MAX) {
+                printf("Error: --history requires a number of samples from 0 to %d\n", HIST_MAX);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--record") == 0 || strcmp(argv[i], "--replay") == 0) {
+            if (i + 1 >= argc) {
+                printf("Error: %s requires a directory\n", argv[i]);
+                return 1;
+            }
+            if (strcmp(argv[i], "--record") == 0) opt_record = argv[++i];
+            else opt_replay = argv[++i];
+        }
+        else if (strcmp(argv[i], "--shm") == 0) {
+            if (i + 1 < argc && argv[i + 1][0] != '\0') opt_shm = argv[++i];
+            else {
+                printf("Error: --shm requires a segment name\n");
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--listen") == 0) {
+            if (i + 1 < argc) opt_listen = argv[++i];
+            else {
+                printf("Error: --listen requires unix:PATH or [HOST:]PORT\n");
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--daemon") == 0) opt_daemon = 1;
+        else if (strcmp(argv[i], "--ring") == 0) {
+            if (i + 1 < argc) {
+                opt_ring = atoi(argv[++i]);
+                if (opt_ring < 1) {
+                    printf("Error: --ring requires a positive number of samples\n");
+                    return 1;
+                }
+            }
+        }
+        else if (strcmp(argv[i], "--ring-dump") == 0) {
+            if (i + 1 < argc) opt_ring_dump = argv[++i];
+        }
         else if (strcmp(argv[i], "--sysinfo") == 0) {
              display_sysinfo();
              return 0;
@@ -898,11 +5615,58 @@ int main(int argc, char **argv) {
                 }
             }
         }
+        else if (strcmp(argv[i], "--statfs-timeout") == 0) {
+            if (i + 1 < argc) opt_statfs_timeout = atoi(argv[++i]);
+            if (opt_statfs_timeout < 1) {
+                printf("Error: --statfs-timeout requires a positive number of milliseconds\n");
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--period") == 0) {
+            if (i + 1 >= argc || parse_periods(argv[++i]) != 0) {
+                printf("Error: --period requires NAME=MS pairs, NAME one of cpu, mem, disk, diskio, net\n");
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--adaptive") == 0) {
+            opt_adaptive = 1;
+            if (i + 1 < argc && isdigit((unsigned char)argv[i + 1][0])) {
+                opt_fast_interval = atoi(argv[++i]);
+                if (opt_fast_interval < 10) {
+                    printf("Warning: fast interval should be at least 10ms. Setting to 10ms.\n");
+                    opt_fast_interval = 10;
+                }
+            }
+        }
+        else if (strcmp(argv[i], "--adapt-threshold") == 0) {
+            if (i + 1 < argc) opt_adapt_threshold = atof(argv[++i]);
+            if (opt_adapt_threshold <= 0 || opt_adapt_threshold > 100) {
+                printf("Error: --adapt-threshold requires a percentage of 1-100\n");
+                return 1;
+            }
+            opt_adaptive = 1;
+        }
+        else if (strcmp(argv[i], "--adapt-slope") == 0) {
+            if (i + 1 < argc) opt_adapt_slope = atof(argv[++i]);
+            if (opt_adapt_slope <= 0) {
+                printf("Error: --adapt-slope requires a positive rate in percent per second\n");
+                return 1;
+            }
+            opt_adaptive = 1;
+        }
+        else if (strcmp(argv[i], "--adapt-hold") == 0) {
+            if (i + 1 < argc) opt_adapt_hold = atoi(argv[++i]);
+            if (opt_adapt_hold < 0) {
+                printf("Error: --adapt-hold requires a non-negative number of milliseconds\n");
+                return 1;
+            }
+            opt_adaptive = 1;
+        }
         else if (strcmp(argv[i], "--log") == 0) {
             if (i + 1 < argc) {
                 opt_log = argv[++i];
-                log_fp = fopen(opt_log, "w");
-                if (!log_fp) {
+                log_fd = open(opt_log, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+                if (log_fd < 0) {
                     perror("Failed to open log file");
                     return 1;
                 }
@@ -911,6 +5675,81 @@ int main(int argc, char **argv) {
                 return 1;
             }
         }
+        else if (strcmp(argv[i], "--log-format") == 0) {
+            if (i + 1 < argc && strcmp(argv[i + 1], "bin") == 0) opt_log_format = LOG_FORMAT_BIN;
+            else if (i + 1 < argc && strcmp(argv[i + 1], "csv") == 0) opt_log_format = LOG_FORMAT_CSV;
+            else {
+                printf("Error: --log-format must be 'csv' or 'bin'\n");
+                return 1;
+            }
+            i++;
+        }
+        else if (strcmp(argv[i], "--log-flush") == 0) {
+            if (i + 1 < argc) {
+                opt_log_flush_ms = atoi(argv[++i]);
+                if (opt_log_flush_ms < 1) opt_log_flush_ms = 1;
+            }
+        }
+        else if (strcmp(argv[i], "--log-queue") == 0) {
+            if (i + 1 < argc) {
+                opt_log_queue_kb = atoi(argv[++i]);
+                if (opt_log_queue_kb < 4) opt_log_queue_kb = 4;
+            }
+        }
+        else if (strcmp(argv[i], "--log-max-size") == 0) {
+            if (i + 1 < argc) opt_log_max_size = parse_size(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--log-rotate") == 0) {
+            if (i + 1 < argc) opt_log_rotate_sec = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--log-keep") == 0) {
+            if (i + 1 < argc) opt_log_keep = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--log-compress") == 0) opt_log_compress = 1;
+        else if (strcmp(argv[i], "--unpack") == 0) {
+            if (i + 1 < argc) return ulz_unpack(argv[i + 1]);
+            printf("Error: --unpack requires a filename\n");
+            return 1;
+        }
+        else if (strcmp(argv[i], "--dump") == 0) {
+            if (i + 1 < argc) return dump_binary_log(argv[i + 1]);
+            printf("Error: --dump requires a filename\n");
+            return 1;
+        }
+        else if (strcmp(argv[i], "--procs") == 0) {
+            if (i + 1 < argc) opt_procs = atoi(argv[++i]);
+            if (opt_procs < 1) {
+                printf("Error: --procs requires a positive number of processes\n");
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--cgroup") == 0) {
+            if (i + 1 < argc) {
+                opt_cgroup = argv[++i];
+            } else {
+                printf("Error: --cgroup requires a cgroup path or 'all'\n");
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--psi") == 0) opt_psi = 1;
+        else if (strcmp(argv[i], "--psi-trigger") == 0) {
+            if (i + 1 < argc) opt_psi_trigger_ms = atoi(argv[++i]);
+            if (opt_psi_trigger_ms < 1 || opt_psi_trigger_ms > 1000) {
+                printf("Error: --psi-trigger requires a stall threshold of 1-1000 ms\n");
+                return 1;
+            }
+            opt_psi = 1;
+        }
+        else if (strcmp(argv[i], "--procs-sort") == 0) {
+            if (i + 1 < argc && strcmp(argv[i + 1], "cpu") == 0) opt_procs_sort = PROCS_SORT_CPU;
+            else if (i + 1 < argc && strcmp(argv[i + 1], "rss") == 0) opt_procs_sort = PROCS_SORT_RSS;
+            else if (i + 1 < argc && strcmp(argv[i + 1], "io") == 0) opt_procs_sort = PROCS_SORT_IO;
+            else {
+                printf("Error: --procs-sort must be 'cpu', 'rss' or 'io'\n");
+                return 1;
+            }
+            i++;
+        }
         else if (strcmp(argv[i], "--net") == 0) {
             opt_net_all = 1;
             if (i + 1 < argc && argv[i+1][0] != '-') {
@@ -919,95 +5758,180 @@ int main(int argc, char **argv) {
         }
     }
     
-    int any_specific = opt_cpu || opt_mem || opt_disks || opt_net_all || opt_cpulist;
+    int any_specific = opt_cpu || opt_mem || opt_disks || opt_net_all || opt_cpulist || opt_procs || opt_psi || opt_cgroup;
     int show_cpu = opt_cpu || opt_cpulist || !any_specific;
     int show_mem = opt_mem || !any_specific;
     int show_disks = opt_disks || !any_specific;
     int show_net = opt_net_all || (!any_specific);
     
     if (!any_specific) show_net = 0;
+    /* Scrapers want interfaces too, even when the display and the log
+     * leave them out: they are sampled but not shown or logged */
+    int sample_net = show_net || (opt_listen && !any_specific);
+    
+    if (opt_record && opt_replay) {
+        printf("Error: --record and --replay cannot be combined\n");
+        return 1;
+    }
+    if (opt_record && record_open(opt_record) != 0) {
+        fprintf(stderr, "Failed to create capture in %s: %s\n", opt_record, strerror(errno));
+        return 1;
+    }
+    if (opt_replay) {
+        if (replay_open(opt_replay) != 0) {
+            fprintf(stderr, "Failed to read capture in %s: %s\n", opt_replay, strerror(errno));
+            return 1;
+        }
+        /* Only proc_src_t reads are in a capture */
+        opt_procs = 0;
+        opt_cgroup = NULL;
+        opt_psi_trigger_ms = 0;
+        /* The capture says what was sampled and how often */
+        uint32_t col = replay_opts.collectors;
+        show_cpu = (col & RECORD_CPU) != 0;
+        show_mem = (col & RECORD_MEM) != 0;
+        show_disks = (col & RECORD_DISKS) != 0;
+        show_net = (col & RECORD_NET) != 0;
+        sample_net = (col & RECORD_NET_SAMPLED) != 0;
+        opt_psi = (col & RECORD_PSI) != 0;
+        for (int c = 0; c < COLL_COUNT; c++) opt_period[c] = (int)replay_opts.period[c];
+        opt_net_iface = replay_opts.net_iface[0] ? replay_opts.net_iface : NULL;
+    }
     
-    if (!opt_mono) {
+    if (opt_replay) {
+        /* Headless and as fast as the parsers go */
+    } else if (opt_daemon) {
+        if (opt_ring == 0) opt_ring = 600;
+        printf("umon: running headless (pid %d), keeping %d samples; send SIGUSR1 to write them to %s\n",
+               (int)getpid(), opt_ring, opt_ring_dump);
+        fflush(stdout);
+    } else if (!isatty(STDOUT_FILENO)) {
+        /* No terminal: plain frames without colours or cursor control */
+        opt_mono = 1;
+        fb_plain = 1;
+    } else if (!opt_mono) {
         printf("\033[?1049h");
         printf("\033[?25l");
         fflush(stdout);
+        screen_active = 1;
     }
     
-    signal(SIGINT, handle_signal);
-    signal(SIGTERM, handle_signal);
+    /* No SA_RESTART: the tick wait must return so the loop can shut down */
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = handle_signal;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGWINCH, handle_winch);
+    /* SIGUSR1 dumps the ring; it is handled once the ring exists */
+    signal(SIGUSR1, SIG_IGN);
     atexit(cleanup);
     
-    init_cpu_stats();
+    init_sampling();
+    /* Only the display reads the history */
+    if (opt_daemon || replay_active) opt_history = 0;
+    if (history_init() != 0) {
+        fprintf(stderr, "Failed to allocate metric history\n");
+        return 1;
+    }
+    sched_init(collectors_tick_ms(opt_interval));
+    if (opt_record) {
+        record_opts.collectors = (show_cpu ? RECORD_CPU : 0) | (show_mem ? RECORD_MEM : 0) |
+                                 (show_disks ? RECORD_DISKS : 0) | (show_net ? RECORD_NET : 0) |
+                                 (sample_net ? RECORD_NET_SAMPLED : 0) | (opt_psi ? RECORD_PSI : 0);
+        record_opts.cores = num_cores;
+        for (int c = 0; c < COLL_COUNT; c++) record_opts.period[c] = opt_period[c];
+        snprintf(record_opts.net_iface, sizeof(record_opts.net_iface), "%s", opt_net_iface ? opt_net_iface : "");
+    }
+    if (replay_active) {
+        mono_anchor = replay_mono_anchor;
+        wall_anchor = replay_wall_anchor;
+    }
+    wheel_init();
+    if (opt_psi_trigger_ms > 0) psi_triggers_init();
+    if (show_disks) mounts_init();
+    if (opt_listen && metrics_init(show_cpu, show_mem, show_disks, sample_net) != 0) {
+        fprintf(stderr, "Failed to listen on %s: %s\n", opt_listen, strerror(errno));
+        return 1;
+    }
     
     int first_run = 1;
+    double last_render = 0;
+    int display_ms = opt_adaptive && opt_interval > DISPLAY_PERIOD_MS ? DISPLAY_PERIOD_MS : opt_interval;
     
-    while (1) {
-        printf("\033[H\033[2J");
-        
-        time_t t = time(NULL);
-        struct tm *tm = localtime(&t);
-        char time_str[10];
-        strftime(time_str, sizeof(time_str), "%H:%M:%S", tm);
-        
-        char title[128];
-        snprintf(title, sizeof(title), "System Monitor (v%s)", __CODEVERSION__);
-        
-        int total_width = 60;
-        int len_txt = strlen(title) + 1 + strlen(time_str);
-        int pad = total_width - len_txt;
-        int pad_l = pad / 2;
-        int pad_r = pad - pad_l;
-        
-        printf("%s", c_magenta());
-        for(int k=0; k<total_width; k++) putchar('=');
-        printf("%s\n", c_reset());
-        
-        printf("%s%s", c_bold(), c_cyan());
-        for(int k=0; k<pad_l; k++) putchar(' ');
-        printf("%s%s %s%s%s%s", title, c_reset(), c_dim(), c_white(), time_str, c_reset());
-        for(int k=0; k<pad_r; k++) putchar(' ');
-        printf("%s\n", c_reset());
-        
-        printf("%s", c_magenta());
-        for(int k=0; k<total_width; k++) putchar('=');
-        printf("%s\n", c_reset());
-        
-        if (show_cpu) {
-            printf("\n");
-            get_cpu_info(30);
-        }
+    double replay_start = get_time_sec();
+    
+    while (!stop_requested) {
+        if (replay_active && replay_next_tick() != 0) break;
+        take_snapshot(snap, show_cpu, show_mem, show_disks, sample_net);
+        long long t0 = self_begin();
+        compute_sample(&cur_sample, show_cpu, show_mem, show_disks, sample_net);
+        history_push(&cur_sample, show_cpu, show_mem, show_net);
+        self_end(STAGE_COMPUTE, t0);
+        /* Before the sinks, so this tick's row carries this tick's figures;
+         * the log, render and export stages were last timed a tick ago */
+        self_tick();
         
-        if (show_mem) {
-            printf("\n");
-            get_memory_info(30);
+        if (opt_listen) {
+            t0 = self_begin();
+            metrics_publish(&cur_sample);
+            self_end(STAGE_EXPORT, t0);
         }
         
-        if (show_disks) {
-            printf("\n");
-            get_disk_info(30);
+        if (first_run) {
+            build_log_schema(&cur_sample, show_cpu, show_mem, show_disks, show_net);
+            log_row = calloc(log_col_count, sizeof(double));
+            if (opt_ring > 0) {
+                if (ring_init(opt_ring) != 0) {
+                    fprintf(stderr, "Failed to allocate ring buffer of %d samples\n", opt_ring);
+                    return 1;
+                }
+                signal(SIGUSR1, handle_ring_dump);
+            }
+            write_log_header();
+            if (opt_shm && shm_create(opt_shm) != 0) {
+                fprintf(stderr, "Failed to create shared memory segment %s: %s\n", opt_shm, strerror(errno));
+                return 1;
+            }
+        } else {
+            t0 = self_begin();
+            log_data(&cur_sample);
+            ring_push(&cur_sample);
+            shm_publish(&cur_sample);
+            self_end(STAGE_LOG, t0);
         }
         
-        if (show_net) {
-            printf("\n");
-            get_net_info(30);
-        }
+        if (opt_adaptive) adapt_update(&cur_sample);
         
-        if (log_fp && !first_run) {
-            log_data(show_cpu, show_mem, show_disks, show_net);
-        } else if (log_fp && first_run) {
-            write_log_header(show_cpu, show_mem, show_disks, show_net);
+        /* Ticks faster than the refresh interval are logged but not all drawn */
+        if (!opt_daemon && !replay_active && (first_run ||
+                            (cur_sample.mono - last_render) * 1000.0 + tick_period_ns / 2e6 >= display_ms)) {
+            t0 = self_begin();
+            render_frame(&cur_sample, show_cpu, show_mem, show_disks, show_net);
+            self_end(STAGE_RENDER, t0);
+            last_render = cur_sample.mono;
         }
         
-        printf("\nPress Ctrl+C to quit.");
-        if (opt_log) {
-            printf(" Logging to: %s", opt_log);
+        if (ring_dump_requested) {
+            ring_dump_requested = 0;
+            if (ring_dump(opt_ring_dump) != 0) perror("Failed to write ring dump");
         }
-        printf("\n");
-        fflush(stdout);
         
-        usleep(opt_interval * 1000);
+        record_flush(mono_anchor, wall_anchor);
+        rotate_snapshots();
+        if (!replay_active) sched_wait();
         first_run = 0;
     }
     
+    double replay_elapsed = get_time_sec() - replay_start;
+    cleanup();
+    print_summary();
+    if (replay_active) {
+        printf("Replayed %llu ticks in %.3f s: %.0f ticks/s\n", replay_ticks, replay_elapsed,
+               replay_elapsed > 0 ? replay_ticks / replay_elapsed : 0.0);
+    }
+    if (opt_record) printf("Recorded %llu ticks to %s/capture.umr\n", record_ticks, opt_record);
     return 0;
 }
+#endif
@@ -0,0 +1,112 @@
+/* umon shared-memory snapshot (umon --shm NAME)
+ *
+ * The segment /dev/shm/NAME holds a header, col_count column names of
+ * name_size bytes each, and col_count doubles. Columns are the CSV log
+ * columns, in the same order and units, fixed for the life of the segment.
+ *
+ * Updates are published with a seqlock: the writer makes seq odd, rewrites
+ * the values, tick and wall, then makes seq even again. A reader copies
+ * between two reads of seq and retries when the first was odd or the two
+ * differ, so it never sees a half-written tick and never blocks the writer.
+ * The version changes whenever the layout does.
+ *
+ * Each run creates a new object, so a mapping of an earlier run stays
+ * valid but goes quiet. umon clears magic when it exits, which
+ * umon_shm_read() reports as UMON_SHM_GONE; attach again to follow the
+ * next run. A writer that crashed leaves magic set, and only its pid tells
+ * (kill(pid, 0) fails once it is gone).
+ *
+ * Readers only need this header:
+ *
+ *     size_t size;
+ *     const umon_shm_header_t *h = umon_shm_attach("umon", &size);
+ *     double *v = malloc(h->col_count * sizeof(double));
+ *     if (umon_shm_read(h, v, &tick, &wall, 100) == 0) ...
+ */
+#ifndef UMON_SHM_H
+#define UMON_SHM_H
+
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define UMON_SHM_MAGIC 0x314d48534e4f4d55ULL   /* "UMONSHM1" little-endian */
+#define UMON_SHM_VERSION 1
+#define UMON_SHM_NAME_SIZE 96
+#define UMON_SHM_GONE -2
+
+typedef struct {
+    uint64_t magic;             /* stored last, once the rest is in place; 0 after exit */
+    uint32_t version;
+    uint32_t header_size;
+    uint32_t col_count;
+    uint32_t name_size;
+    uint64_t names_offset;
+    uint64_t values_offset;
+    uint64_t size;              /* whole segment in bytes */
+    int32_t pid;                /* the publishing umon */
+    uint32_t reserved;
+    uint64_t seq;               /* odd while an update is in progress */
+    uint64_t tick;              /* updates published so far */
+    double wall;                /* sample time, seconds since the epoch */
+} umon_shm_header_t;
+
+static inline const char *umon_shm_col_name(const umon_shm_header_t *h, uint32_t i) {
+    return (const char *)h + h->names_offset + (size_t)i * h->name_size;
+}
+
+/* Maps a segment read-only; NULL when it is missing, incomplete or of
+ * another version. */
+static inline const umon_shm_header_t *umon_shm_attach(const char *name, size_t *size) {
+    char path[256];
+    if (name[0] == '/') name++;
+    path[0] = '/';
+    strncpy(path + 1, name, sizeof(path) - 2);
+    path[sizeof(path) - 1] = '\0';
+
+    int fd = shm_open(path, O_RDONLY | O_CLOEXEC, 0);
+    if (fd < 0) return NULL;
+    struct stat st;
+    void *p = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(umon_shm_header_t)) {
+        p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (p == MAP_FAILED) return NULL;
+
+    const umon_shm_header_t *h = (const umon_shm_header_t *)p;
+    if (__atomic_load_n(&h->magic, __ATOMIC_ACQUIRE) != UMON_SHM_MAGIC ||
+        h->version != UMON_SHM_VERSION || h->size > (uint64_t)st.st_size) {
+        munmap(p, st.st_size);
+        return NULL;
+    }
+    *size = st.st_size;
+    return h;
+}
+
+/* Copies one consistent tick into values[col_count]. Returns 0, -1 when
+ * every one of max_tries attempts overlapped an update, or UMON_SHM_GONE
+ * when the writer has exited. */
+static inline int umon_shm_read(const umon_shm_header_t *h, double *values,
+                                uint64_t *tick, double *wall, int max_tries) {
+    const char *src = (const char *)h + h->values_offset;
+    for (int t = 0; t < max_tries; t++) {
+        if (__atomic_load_n(&h->magic, __ATOMIC_ACQUIRE) != UMON_SHM_MAGIC) return UMON_SHM_GONE;
+        uint64_t s1 = __atomic_load_n(&h->seq, __ATOMIC_ACQUIRE);
+        if (s1 & 1) continue;
+        memcpy(values, src, (size_t)h->col_count * sizeof(double));
+        uint64_t tk = h->tick;
+        double w = h->wall;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&h->seq, __ATOMIC_RELAXED) != s1) continue;
+        if (tick) *tick = tk;
+        if (wall) *wall = w;
+        return 0;
+    }
+    return -1;
+}
+
+#endif